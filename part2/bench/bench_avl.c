@@ -0,0 +1,79 @@
+/***************************************************************
+ *
+ * file: bench_avl.c
+ *
+ * @brief   Benchmark of a group's info tree under sorted id ingest.
+ * Producers emit increasing ids, which made the unbalanced tree a
+ * list. The cost per insert and per pruned info has to grow with
+ * log(n), so it should barely move while n grows 64 times.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pss.h"
+
+#define MIN_INFOS (1 << 16)
+#define MAX_INFOS (1 << 22)
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Inserts n infos with increasing ids into group 0 and prunes them all */
+static int run(int n, double *insert, double *prune) {
+    Config cfg = { 0 };
+    int gids[2] = { 0, -1 };
+    int i;
+    double t;
+
+    cfg.groups = 1;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_NONE;
+    if (initialize_config(11, 101, &cfg) != 0) {
+        return 1;
+    }
+    if (Subscriber_Registration(0, 0, gids, 2) != 0) {
+        return 1;
+    }
+    t = now();
+    for (i = 0; i < n; i++) {
+        if (Insert_Info(i, i, gids, 2) != 0) {
+            fprintf(stderr, "Insert_Info %d failed\n", i);
+            return 1;
+        }
+    }
+    *insert = (now() - t) / n * 1e9;
+    t = now();
+    if (Prune(n) != 0 || Consume_Pending(0, 0) != n) {
+        fprintf(stderr, "Prune %d failed\n", n);
+        return 1;
+    }
+    *prune = (now() - t) / n * 1e9;
+    return free_all();
+}
+
+int main(void) {
+    double insert, prune, first = 0;
+    int n;
+
+    printf("%10s %12s %12s\n", "infos", "insert ns", "prune ns");
+    for (n = MIN_INFOS; n <= MAX_INFOS; n *= 2) {
+        if (run(n, &insert, &prune) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (n == MIN_INFOS) {
+            first = insert;
+        }
+        printf("%10d %12.1f %12.1f\n", n, insert, prune);
+    }
+    printf("insert cost grew %.2fx while n grew %dx\n", insert / first, MAX_INFOS / MIN_INFOS);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/***************************************************************
+ *
+ * file: bench_publish.c
+ *
+ * @brief   Benchmark of the publish queue against direct inserts.
+ * Producer threads publish infos while the main thread drains them,
+ * then the same producers call Insert_Info on a thread safe engine.
+ * It reports the latency of a producer's call (what a publisher
+ * waits for) and the sustained rate until every info is inserted.
+ * Every info must be inserted once, which a subscriber of all their
+ * first groups checks after a prune.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pss.h"
+
+#define INFOS 200000 // Per producer
+#define MAX_PRODUCERS 4
+#define CAPACITY 4096
+#define BATCH 256
+
+struct Producer {
+    int id;
+    int publish;            // Publish_Info or Insert_Info
+    int failed;
+    double sum;             // Time spent in the calls
+    double worst;
+};
+typedef struct Producer Producer;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void *produce(void *arg) {
+    Producer *p = (Producer *) arg;
+    int gids[3], i, id;
+    double t;
+
+    for (i = 0; i < INFOS; i++) {
+        id = p->id * INFOS + i;
+        // One of the subscriber's groups and one of the others
+        gids[0] = id % 8;
+        gids[1] = 8 + (id / 8) % 56;
+        gids[2] = -1;
+        t = now();
+        if (p->publish) {
+            // A full queue makes the producer wait for the drain
+            while (Publish_Info(id, id, gids, 3) != 0) {
+                sched_yield();
+            }
+        } else if (Insert_Info(id, id, gids, 3) != 0) {
+            p->failed++;
+        }
+        t = now() - t;
+        p->sum += t;
+        if (t > p->worst) {
+            p->worst = t;
+        }
+    }
+    return NULL;
+}
+
+static void inserted(int iTM, int iId, int status, void *ctx) {
+    (void) iTM;
+    (void) iId;
+    if (status != 0) {
+        (*(int *) ctx)++;
+    }
+}
+
+/* Inserts the infos of n producers, published or direct */
+static int run(int n, int publish) {
+    pthread_t threads[MAX_PRODUCERS];
+    Producer p[MAX_PRODUCERS];
+    Config cfg = { 0 };
+    int gids[9] = { 0, 1, 2, 3, 4, 5, 6, 7, -1 };
+    long taken = 0, total = (long) n * INFOS;
+    double t, sum = 0, worst = 0;
+    int i, k, failed = 0;
+
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_NONE;
+    cfg.threadsafe = !publish;
+    cfg.publish = publish ? CAPACITY : 0;
+    if (initialize_config(11, 101, &cfg) != 0 || Subscriber_Registration(0, 0, gids, 9) != 0) {
+        fprintf(stderr, "initialization failed\n");
+        return 1;
+    }
+    t = now();
+    for (i = 0; i < n; i++) {
+        p[i].id = i;
+        p[i].publish = publish;
+        p[i].failed = 0;
+        p[i].sum = 0;
+        p[i].worst = 0;
+        pthread_create(&threads[i], NULL, produce, &p[i]);
+    }
+    while (publish && taken < total) {
+        k = Publish_Drain(BATCH, inserted, &failed);
+        if (k == 0) {
+            sched_yield();
+        }
+        taken += k;
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+        failed += p[i].failed;
+        sum += p[i].sum;
+        if (p[i].worst > worst) {
+            worst = p[i].worst;
+        }
+    }
+    t = now() - t;
+    if (failed != 0 || Prune((int) total) != 0 || Consume_Pending(0, -1) != total) {
+        fprintf(stderr, "%d inserts failed, %ld of %ld infos delivered\n", failed,
+                Consume_Pending(0, -1), total);
+        return 1;
+    }
+    printf("%-8s %10d %12.2f %12.0f %12.1f\n", publish ? "publish" : "direct", n,
+           total / t / 1e6, sum / total * 1e9, worst * 1e6);
+    return free_all();
+}
+
+int main(void) {
+    int n;
+
+    printf("%-8s %10s %12s %12s %12s\n", "mode", "producers", "Minfos/s", "mean ns", "worst us");
+    for (n = 1; n <= MAX_PRODUCERS; n *= 2) {
+        if (run(n, 1) != 0 || run(n, 0) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -8,121 +8,413 @@
  * @e-mail       hy240-list@csd.uoc.gr
  *
  * @brief   Main function for the needs of CS-240 project 2022.Prof. Panagiota Fatourou.
- * @see     Compile with command: gcc -ansi main.c pss.c -o run
+ * @see     Compile with command: gcc -std=c99 -pthread main.c pss.c -o run
  ***************************************************************
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
 
 #include "pss.h"
 
-#define BUFFER_SIZE 1024 /* Maximum length of a line in input file */
+#define BUFFER_SIZE 65536 /* Initial size of the input buffer (grows for longer lines) */
+#define MAX_THREADS 64 /* Maximum number of parsing threads in mmap mode */
+#define MIN_CHUNK (1 << 20) /* Minimum bytes per parsing thread in mmap mode */
+#define PUBLISH_BATCH 256 /* Most published infos inserted per drain */
+#define EVENT_QUEUED 2 /* handle_event: The info was published, its result comes with the drain */
+#define SERVER_BACKLOG 128 /* Connections waiting to be accepted by the server */
+#define SOCKET_READ 65536 /* Bytes read from a socket at a time */
+#define SOCKET_EVENTS 64 /* Socket events handled per wakeup */
+#define SOCKET_PENDING (1 << 20) /* The server stops reading a client with this much output unsent */
+
+/* Binary trace format (all integers little endian):
+ *   header:  "PSSB" <version:u8> <flags:u8> <reserved:u16>
+ *   event:   <type:u8> <payload length:u32> <payload>
+ *            The payload holds the event's arguments (without the
+ *            terminating -1) as zigzag varints.
+ *   footer:  (if flags & TRACE_INDEXED) the offsets of every
+ *            TRACE_STRIDE-th event <offset:u64>...
+ *            <number of offsets:u64> <number of events:u64>
+ *            <stride:u32> "PSSI" */
+#define TRACE_MAGIC "PSSB"
+#define TRACE_FOOTER_MAGIC "PSSI"
+#define TRACE_VERSION 1
+#define TRACE_INDEXED 1
+#define TRACE_HEADER 8
+#define TRACE_EVENT_HEADER 5
+#define TRACE_FOOTER 24
+#define TRACE_STRIDE 4096
 
 /* Uncomment the following line to enable debugging prints
  * or comment to disable it */
-#define DEBUG
+/* #define DEBUG */
 #ifdef DEBUG
 #define DPRINT(...) fprintf(stderr, __VA_ARGS__);
 #else /* DEBUG */
-#define DPRINT(...)
+#define DPRINT(...) do { } while (0)
 #endif /* DEBUG */
 
+/* Buffered line reader over the input file */
+struct LineReader {
+    FILE *fin;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int eof;
+};
+typedef struct LineReader LineReader;
+
+/* Growable array for event arguments */
+struct IntArena {
+    int *arr;
+    size_t size;
+    size_t cap;
+};
+typedef struct IntArena IntArena;
+
+/* Pre-parsed event (mmap mode) */
+struct Event {
+    const char *line;  /* Line in the mapped file (not '\0' terminated) */
+    size_t len;        /* Length of the line, newline included */
+    size_t args;       /* Offset of the arguments in the chunk's arena */
+    unsigned int nargs;
+};
+typedef struct Event Event;
+
+/* Part of the mapped file, parsed by one thread (mmap mode) */
+struct Chunk {
+    const char *begin;
+    const char *end;
+    Event *events;
+    size_t nevents;
+    size_t cap;
+    IntArena args;
+    pthread_t tid;
+};
+typedef struct Chunk Chunk;
+
+/* Growable byte buffer (server and load generator) */
+struct Buffer {
+    char *buf;
+    size_t start;      /* Bytes before it were written out already */
+    size_t len;
+    size_t cap;
+};
+typedef struct Buffer Buffer;
+
+/* Client connection of the server */
+struct Conn {
+    int fd;
+    Buffer in;         /* Commands read, the last one may be incomplete */
+    Buffer out;        /* Responses not written yet */
+    int eof;           /* The client is done sending */
+    int events;        /* Epoll events waited for */
+    struct Conn *prev;
+    struct Conn *next;
+};
+typedef struct Conn Conn;
+
+/* Connection of the load generator. It sends the lines next, next+conns,
+ * ... and counts the responses of those lines in acked the same way */
+struct Client {
+    int fd;
+    Buffer out;        /* Commands not written yet */
+    double *sent;      /* Times the commands in flight were queued (depth of them) */
+    size_t next;
+    size_t acked;
+    char status[8];    /* Start of the response line being read */
+    size_t statuslen;
+    int events;        /* Epoll events waited for */
+};
+typedef struct Client Client;
+
+/**
+ * @brief Initialize a line reader
+ *
+ * @param r Line reader
+ * @param fin Input file
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int reader_init(LineReader *r, FILE *fin){
+    r->fin = fin;
+    r->cap = BUFFER_SIZE;
+    r->buf = malloc(r->cap);
+    r->start = 0;
+    r->end = 0;
+    r->eof = 0;
+    return r->buf == NULL;
+}
+
+/**
+ * @brief Read the next line of the input file
+ *
+ * The line stays in the reader's buffer (newline included, not '\0'
+ * terminated) and is only valid until the next call. Lines of any length
+ * are supported.
+ *
+ * @param r Line reader
+ * @param len Set to the length of the line
+ *
+ * @return The line, NULL at the end of the file
+ */
+static char * read_line(LineReader *r, size_t *len){
+    char *nl, *line;
+    size_t n;
+    for (;;) {
+        nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+        if (nl != NULL || (r->eof && r->start < r->end)) {
+            line = r->buf + r->start;
+            n = (nl != NULL) ? (size_t)(nl - line) + 1 : r->end - r->start;
+            r->start += n;
+            *len = n;
+            return line;
+        }
+        if (r->eof) return NULL;
+        /* Moves the partial line to the front and grows the buffer if it's full */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) {
+            char *buf = realloc(r->buf, 2 * r->cap);
+            if (buf == NULL) {
+                fprintf(stderr, "\n Out of memory while reading a line\n");
+                exit(EXIT_FAILURE);
+            }
+            r->buf = buf;
+            r->cap *= 2;
+        }
+        n = fread(r->buf + r->end, 1, r->cap - r->end, r->fin);
+        if (n == 0) r->eof = 1;
+        r->end += n;
+    }
+}
+
+/**
+ * @brief Parse the next integer of a line
+ *
+ * Skips leading white space and accepts an optional sign, like "%d".
+ *
+ * @param p Pointer to the current position, advanced past the integer
+ * @param end End of the line
+ * @param value Set to the parsed integer
+ *
+ * @return 1 if an integer was parsed
+ *         0 otherwise
+ */
+static int next_int(const char **p, const char *end, int *value){
+    const char *s = *p;
+    int neg = 0;
+    unsigned int v = 0;
+    while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n' || *s == '\v' || *s == '\f')) s++;
+    if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+    if (s == end || *s < '0' || *s > '9') return 0;
+    do {
+        v = v * 10 + (unsigned int)(*s++ - '0');
+    } while (s < end && *s >= '0' && *s <= '9');
+    *value = neg ? -(int)v : (int)v;
+    *p = s;
+    return 1;
+}
+
 /**
  * @brief Parsing event arguments from buffer
  *
+ * Single pass over the line. The arguments are appended to the arena, which
+ * is reused across events and only grows for the longest line seen.
+ *
  * @param buff String of current line in the test file
+ * @param len Length of the line
  * @param int_arr_size Pointer to integer that represents the number of arguments in the test after the Event char
+ * @param arena Storage for the arguments
  *
- * @return 0 on success
- *         1 on failure
+ * @return The arguments (terminated by -1), valid until the next call
  */
-static int * event_args(char *buff,unsigned int * int_arr_size){
-    int * int_arr;
-    char event='\0';
+static int * event_args(const char *buff, size_t len, unsigned int * int_arr_size, IntArena *arena){
+    const char *p = buff+1, *end = buff+len;
     int value;
-    char *p =buff+1;
-    unsigned int len = 0;
-    unsigned int count_args=1;
-    unsigned int i =0;
-    sscanf(buff, "%c", &event);
-    while (sscanf(p, "%d%n", &value, &len)==1 && value!=-1 ) {
-        count_args++;
-        p += len;
-    }
-    p=buff+1;
-    (*int_arr_size)=count_args;
-    int_arr= malloc(count_args*sizeof(int));
-    while (sscanf(p, "%d%n", &value, &len)==1) {
-        int_arr[i++]=value;
-        p += len;
-        if(value ==-1){
-            break;
+    int *args;
+    unsigned int i = 0;
+    for (;;) {
+        if (arena->size + i + 1 >= arena->cap) {
+            size_t cap = arena->cap ? 2 * arena->cap : 64;
+            int *arr = realloc(arena->arr, cap*sizeof(int));
+            if (arr == NULL) {
+                fprintf(stderr, "\n Out of memory while parsing a line\n");
+                exit(EXIT_FAILURE);
+            }
+            arena->arr = arr;
+            arena->cap = cap;
         }
+        if (!next_int(&p, end, &value) || value == -1) break;
+        arena->arr[arena->size + i++] = value;
     }
+    /* The argument list always ends with -1 (also when the line misses it) */
+    arena->arr[arena->size + i++] = -1;
+    args = arena->arr + arena->size;
+    arena->size += i;
+    (*int_arr_size)=i;
+    return args;
+}
+
+/**
+ * @brief Wall clock time in seconds
+ *
+ * @return Seconds since an arbitrary point
+ */
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    return int_arr;
+/**
+ * @brief Check if a line is an event with arguments
+ *
+ * @param c First char of the line
+ *
+ * @return 1 if it is
+ *         0 otherwise
+ */
+static int has_args(char c){
+    return c == 'I' || c == 'S' || c == 'R' || c == 'C' || c == 'D';
 }
 
 /**
- * @brief The main function
+ * @brief Report the results of the parse-only benchmark
  *
- * @param argc Number of arguments
- * @param argv Argument vector
+ * @param events Number of events parsed
+ * @param bytes Number of bytes read
+ * @param sum Checksum of the arguments
+ * @param secs Elapsed seconds
+ */
+static void parse_report(unsigned long long events, unsigned long long bytes, unsigned long long sum, double secs){
+    printf("PARSE events = %llu, bytes = %llu, seconds = %.3f, events/sec = %.0f, MB/sec = %.1f, checksum = %llu\n",
+           events, bytes, secs, secs > 0 ? events / secs : 0.0,
+           secs > 0 ? bytes / secs / 1e6 : 0.0, sum);
+}
+
+/**
+ * @brief Parse-only benchmark: parses every event without handling it
+ *
+ * @param r Line reader
+ * @param arena Storage for the arguments
  *
  * @return 0 on success
  *         1 on failure
  */
-int main(int argc, char **argv)
-{
-	FILE *fin = NULL;
-	char buff[BUFFER_SIZE], event='\0';
+static int parse_only(LineReader *r, IntArena *arena){
+    unsigned long long events = 0, bytes = 0, sum = 0;
+    unsigned int i, n;
+    size_t len;
+    char *line;
+    int *args;
+    double start = now();
+    while ((line = read_line(r, &len)) != NULL) {
+        bytes += len;
+        if (has_args(line[0])) {
+            arena->size = 0;
+            args = event_args(line, len, &n, arena);
+            /* Uses the arguments so the parsing can't be optimized away */
+            for (i = 0; i < n; i++) sum += (unsigned int)args[i];
+        }
+        if (has_args(line[0]) || line[0] == 'P') events++;
+    }
+    parse_report(events, bytes, sum, now() - start);
+    return EXIT_SUCCESS;
+}
 
-	/* Check command buff arguments */
-	if (argc != 4)
-	{
-		fprintf(stderr, "Usage: %s <m> <p> <input_file>\n", argv[0]);
-		return EXIT_FAILURE;
-	}
+/* Infos are passed through the publish queue (--publish) */
+static int publishing = 0;
 
-	/* Parse command buff arguments */
-	int hashTableSize = atoi(argv[1]);
-	int universalHashingNumber = atoi(argv[2]);
+/**
+ * @brief Report the insert of a published info, as handle_event reports
+ *        the infos it inserts itself
+ *
+ * @param iTM Timestamp of arrival
+ * @param iId Identifier of information
+ * @param status 0 if it was inserted, 1 if its id was not unique
+ * @param ctx Unused
+ */
+static void published(int iTM, int iId, int status, void *ctx){
+    (void)ctx;
+    if (status == 0)
+    {
+        DPRINT("I <%d> <%d> DONE\n", iTM, iId);
+    }
+    else
+    {
+        fprintf(stderr, "I %d %d failed\n", iTM, iId);
+    }
+}
 
-	if (hashTableSize <= 0)
-	{
-		fprintf(stderr, "\n Invalid hash table size: %d\n", hashTableSize);
-		perror("Parsing command line argument\n");
-		return EXIT_FAILURE;
-	}
+/* Told the results of the published infos' inserts (the server adds
+ * them to the responses) */
+static PublishCallback on_published = published;
+static void *published_ctx = NULL;
 
-	if (universalHashingNumber <= 0)
-	{
-		fprintf(stderr, "\n Invalid universal hashing number: %d\n", universalHashingNumber);
-		perror("Parsing command line argument\n");
-		return EXIT_FAILURE;
-	}
-
-	/* Open input file */
-	if ((fin = fopen(argv[3], "r")) == NULL)
-	{
-		fprintf(stderr, "\n Could not open file: %s\n", argv[3]);
-		perror("Opening test file\n");
-		return EXIT_FAILURE;
-	}
-    
-	/* Initializations */
-	initialize(hashTableSize, universalHashingNumber);
+/**
+ * @brief Insert the infos waiting in the publish queue
+ */
+static void drain_published(void){
+    if (!publishing) return;
+    while (Publish_Drain(PUBLISH_BATCH, on_published, published_ctx) > 0);
+}
 
-	/* Read input file buff-by-buff and handle the events */
-	while (fgets(buff, BUFFER_SIZE, fin))
-	{
-		DPRINT("\n>>> Event: %s\n", buff);
-		switch (buff[0])
+/**
+ * @brief Handle an event
+ *
+ * @param type Event type (first char of the line)
+ * @param buff Line of the event (not '\0' terminated, NULL if not available)
+ * @param len Length of the line
+ * @param event_args_arr Arguments of the event (NULL for events without arguments)
+ * @param num_of_args Number of arguments
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int handle_event(char type, const char *buff, size_t len, int *event_args_arr, unsigned int num_of_args){
+		int ret = EXIT_SUCCESS;
+		if (buff != NULL) DPRINT("\n>>> Event: %.*s\n", (int)len, buff);
+		/* Published infos are inserted before the next other event,
+		 * or when the queue fills up */
+		if (publishing && type == 'I' && num_of_args >= 2)
+		{
+			if (Publish_Info(event_args_arr[0], event_args_arr[1], event_args_arr + 2, num_of_args - 2) == 0)
+				return EVENT_QUEUED;
+			drain_published();
+			if (Publish_Info(event_args_arr[0], event_args_arr[1], event_args_arr + 2, num_of_args - 2) == 0)
+				return EVENT_QUEUED;
+		}
+		else if (has_args(type) || type == 'P')
+		{
+			drain_published();
+		}
+		switch (type)
 		{
 
 		/* Comment */
@@ -135,24 +427,24 @@ int main(int argc, char **argv)
 		{
 			int itm;
 			int iId;
-            unsigned int num_of_gids;
-            int * event_args_arr;
+            unsigned int num_of_gids = num_of_args;
             int * gids_arr;
-            event_args_arr=event_args(buff, &num_of_gids);
             itm=event_args_arr[0];
             iId=event_args_arr[1];
             gids_arr= event_args_arr+2;
             num_of_gids-=2;
-			if (Insert_Info(itm,iId,gids_arr,num_of_gids)==0)
+			if ((ret = Insert_Info(itm,iId,gids_arr,num_of_gids))==0)
+			{
+				DPRINT("%c <%d> <%d> DONE\n",type, itm,iId);
+			}
+			else if (buff != NULL)
 			{
-				DPRINT("%c <%d> <%d> DONE\n",buff[0], itm,iId);
+				fprintf(stderr, "%.*s failed\n", (int)len, buff);
 			}
 			else
 			{
-				fprintf(stderr, "%s failed\n", buff);
+				fprintf(stderr, "%c %d %d failed\n", type, itm, iId);
 			}
-            num_of_gids=0;
-            free(event_args_arr);
 			break;
 		}
 
@@ -161,24 +453,24 @@ int main(int argc, char **argv)
 		case 'S':
 		{
             int sTM, sId;
-            unsigned int num_of_gids;
-            int * event_args_arr;
+            unsigned int num_of_gids = num_of_args;
             int * gids_arr;
-            event_args_arr=event_args(buff, &num_of_gids);
             sTM=event_args_arr[0];
             sId=event_args_arr[1];
             gids_arr= event_args_arr+2;
             num_of_gids-=2;
-            if (Subscriber_Registration(sTM,sId,gids_arr,num_of_gids)==0)
+            if ((ret = Subscriber_Registration(sTM,sId,gids_arr,num_of_gids))==0)
             {
-                DPRINT("%c <%d> <%d> DONE\n", buff[0],sTM,sId);
+                DPRINT("%c <%d> <%d> DONE\n", type,sTM,sId);
+            }
+            else if (buff != NULL)
+            {
+                fprintf(stderr, "%.*s failed\n", (int)len, buff);
             }
             else
             {
-                fprintf(stderr, "%s failed\n", buff);
+                fprintf(stderr, "%c %d %d failed\n", type, sTM, sId);
             }
-            num_of_gids=0;
-            free(event_args_arr);
 			break;
 		}
 
@@ -186,9 +478,9 @@ int main(int argc, char **argv)
 		 * R <tm> */
 		case 'R':
 		{
-            int tm;
-			sscanf(buff, "%c %d", &event, &tm);
-			if (Prune(tm)==0)
+            int tm = event_args_arr[0];
+            char event = type;
+			if ((ret = Prune(tm))==0)
 			{
 				DPRINT("%c <%d> DONE\n", event, tm);
 			}
@@ -203,9 +495,9 @@ int main(int argc, char **argv)
 		 * C <sId> */
 		case 'C':
 		{
-            int sId;
-			sscanf(buff, "%c %d", &event, &sId);
-			if (Consume(sId)==0)
+            int sId = event_args_arr[0];
+            char event = type;
+			if ((ret = Consume(sId))==0)
 			{
 				DPRINT("%c <%d> DONE\n", event,sId);
 			}
@@ -220,9 +512,9 @@ int main(int argc, char **argv)
 		 * D <sId>: */
 		case 'D':
 		{
-			int sId;
-			sscanf(buff, "%c %d", &event, &sId);
-            if (Delete_Subscriber(sId)==0)
+			int sId = event_args_arr[0];
+			char event = type;
+            if ((ret = Delete_Subscriber(sId))==0)
 			{
 				DPRINT("%c <%d> DONE\n", event, sId);
 			}
@@ -237,13 +529,13 @@ int main(int argc, char **argv)
 		 * P */
 		case 'P':
 		{
-			if (Print_all()==0)
+			if ((ret = Print_all())==0)
 			{
-				DPRINT("%c DONE\n", buff[0]);
+				DPRINT("%c DONE\n", type);
 			}
 			else
 			{
-				fprintf(stderr, "%c failed\n", buff[0]);
+				fprintf(stderr, "%c failed\n", type);
 			}
 
 			break;
@@ -253,11 +545,1297 @@ int main(int argc, char **argv)
 			break;
 		/* Ignore everything else */
 		default:
-			DPRINT("Ignoring line: %s \n", buff);
+			if (buff != NULL) DPRINT("Ignoring line: %.*s \n", (int)len, buff);
 			break;
 		}
+		return ret;
+}
+
+/**
+ * @brief Thread body: tokenizes the lines of a chunk into its event array
+ *
+ * @param arg The chunk
+ *
+ * @return NULL
+ */
+static void * parse_chunk(void *arg){
+    Chunk *c = arg;
+    const char *p = c->begin, *nl;
+    Event *e;
+    while (p < c->end) {
+        nl = memchr(p, '\n', (size_t)(c->end - p));
+        if (c->nevents == c->cap) {
+            c->cap = c->cap ? 2 * c->cap : 1024;
+            c->events = realloc(c->events, c->cap * sizeof(Event));
+            if (c->events == NULL) {
+                fprintf(stderr, "\n Out of memory while parsing the input\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        e = &c->events[c->nevents++];
+        e->line = p;
+        e->len = (nl != NULL) ? (size_t)(nl - p) + 1 : (size_t)(c->end - p);
+        e->args = c->args.size;
+        e->nargs = 0;
+        if (has_args(p[0])) event_args(p, e->len, &e->nargs, &c->args);
+        p += e->len;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Replay the input file through mmap: the file is split into chunks
+ * at line boundaries, the chunks are tokenized in parallel and the events
+ * are handled in their original order
+ *
+ * @param path Input file
+ * @param threads Number of parsing threads (0 for one per CPU)
+ * @param parseOnly Only parse the events and report the parsing speed
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int replay_mmap(const char *path, int threads, int parseOnly){
+    int fd, i, n;
+    struct stat st;
+    size_t size, j, k;
+    const char *data = NULL, *p;
+    Chunk chunks[MAX_THREADS];
+    unsigned long long events = 0, sum = 0;
+    double start = now();
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "\n Could not open file: %s\n", path);
+        perror("Opening test file\n");
+        if (fd >= 0) close(fd);
+        return EXIT_FAILURE;
+    }
+    size = (size_t)st.st_size;
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            perror("Mapping test file\n");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    /* Splits the file at newline boundaries */
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((size_t)threads > size / MIN_CHUNK) threads = (int)(size / MIN_CHUNK);
+    if (threads < 1) threads = 1;
+    p = data;
+    for (n = 0; n < threads && p < data + size; n++)
+    {
+        const char *end = data + size * (n + 1) / threads;
+        if (end < p) end = p;
+        if (end < data + size)
+        {
+            const char *nl = memchr(end, '\n', (size_t)(data + size - end));
+            end = (nl != NULL) ? nl + 1 : data + size;
+        }
+        chunks[n].begin = p;
+        chunks[n].end = end;
+        chunks[n].events = NULL;
+        chunks[n].nevents = 0;
+        chunks[n].cap = 0;
+        chunks[n].args.arr = NULL;
+        chunks[n].args.size = 0;
+        chunks[n].args.cap = 0;
+        p = end;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (pthread_create(&chunks[i].tid, NULL, parse_chunk, &chunks[i]) != 0)
+        {
+            fprintf(stderr, "\n Could not start a parsing thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Handles the chunks in order, as soon as each one is parsed */
+    for (i = 0; i < n; i++)
+    {
+        pthread_join(chunks[i].tid, NULL);
+        for (j = 0; j < chunks[i].nevents; j++)
+        {
+            Event *e = &chunks[i].events[j];
+            int *args = chunks[i].args.arr + e->args;
+            if (parseOnly)
+            {
+                if (has_args(e->line[0]) || e->line[0] == 'P') events++;
+                for (k = 0; k < e->nargs; k++) sum += (unsigned int)args[k];
+            }
+            else
+            {
+                handle_event(e->line[0], e->line, e->len, e->nargs ? args : NULL, e->nargs);
+            }
+        }
+        free(chunks[i].events);
+        free(chunks[i].args.arr);
+    }
+    if (parseOnly) parse_report(events, size, sum, now() - start);
+
+    if (size > 0) munmap((void *)data, size);
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Store a little endian integer
+ *
+ * @param b Destination
+ * @param v Value
+ * @param n Number of bytes
+ */
+static void put_le(unsigned char *b, uint64_t v, int n){
+    int i;
+    for (i = 0; i < n; i++) b[i] = (unsigned char)(v >> (8 * i));
+}
+
+/**
+ * @brief Load a little endian integer
+ *
+ * @param b Source
+ * @param n Number of bytes
+ *
+ * @return The value
+ */
+static uint64_t get_le(const unsigned char *b, int n){
+    uint64_t v = 0;
+    int i;
+    for (i = n - 1; i >= 0; i--) v = (v << 8) | b[i];
+    return v;
+}
+
+/**
+ * @brief Encode an integer as a zigzag varint
+ *
+ * @param b Destination (at least 5 bytes)
+ * @param v Value
+ *
+ * @return Number of bytes written
+ */
+static size_t varint_put(unsigned char *b, int v){
+    uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)-(int32_t)(v < 0);
+    size_t n = 0;
+    while (u >= 0x80) {
+        b[n++] = (unsigned char)(u | 0x80);
+        u >>= 7;
+    }
+    b[n++] = (unsigned char)u;
+    return n;
+}
+
+/**
+ * @brief Decode a zigzag varint
+ *
+ * @param p Pointer to the current position, advanced past the varint
+ * @param end End of the payload
+ * @param value Set to the decoded integer
+ *
+ * @return 1 on success
+ *         0 if the varint is truncated or too long
+ */
+static int varint_get(const unsigned char **p, const unsigned char *end, int *value){
+    const unsigned char *s = *p;
+    uint32_t u = 0;
+    int shift = 0;
+    while (s < end && shift < 35) {
+        u |= (uint32_t)(*s & 0x7f) << shift;
+        if (!(*s++ & 0x80)) {
+            *value = (int)(u >> 1) ^ -(int)(u & 1);
+            *p = s;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert a text trace to the binary trace format
+ *
+ * Comments, empty lines and unknown lines are dropped.
+ *
+ * @param in Text trace
+ * @param out Binary trace to create
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int convert_trace(const char *in, const char *out){
+    FILE *fin, *fout;
+    LineReader reader;
+    IntArena arena = { NULL, 0, 0 };
+    unsigned char head[TRACE_HEADER], *payload = NULL;
+    size_t len, cap = 0, plen;
+    uint64_t offset = TRACE_HEADER, events = 0, *index = NULL;
+    size_t nindex = 0, capindex = 0;
+    unsigned int i, n;
+    char *line;
+    int *args;
+
+    if ((fin = fopen(in, "r")) == NULL)
+    {
+        fprintf(stderr, "\n Could not open file: %s\n", in);
+        perror("Opening test file\n");
+        return EXIT_FAILURE;
+    }
+    if ((fout = fopen(out, "wb")) == NULL)
+    {
+        fprintf(stderr, "\n Could not create file: %s\n", out);
+        perror("Creating binary trace\n");
+        fclose(fin);
+        return EXIT_FAILURE;
+    }
+    if (reader_init(&reader, fin))
+    {
+        fprintf(stderr, "\n Could not allocate the input buffer\n");
+        fclose(fin);
+        fclose(fout);
+        return EXIT_FAILURE;
+    }
+    memcpy(head, TRACE_MAGIC, 4);
+    head[4] = TRACE_VERSION;
+    head[5] = TRACE_INDEXED;
+    put_le(head + 6, 0, 2);
+    fwrite(head, 1, TRACE_HEADER, fout);
+
+    while ((line = read_line(&reader, &len)) != NULL)
+    {
+        n = 1;
+        args = NULL;
+        if (has_args(line[0]))
+        {
+            arena.size = 0;
+            args = event_args(line, len, &n, &arena);
+        }
+        else if (line[0] != 'P')
+            continue;
+        /* Event header followed by the arguments (the -1 is implied) */
+        if (cap < TRACE_EVENT_HEADER + 5 * (size_t)n)
+        {
+            cap = TRACE_EVENT_HEADER + 5 * (size_t)n;
+            payload = realloc(payload, cap);
+            if (payload == NULL)
+            {
+                fprintf(stderr, "\n Out of memory while converting\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        plen = TRACE_EVENT_HEADER;
+        for (i = 0; i + 1 < n; i++) plen += varint_put(payload + plen, args[i]);
+        payload[0] = (unsigned char)line[0];
+        put_le(payload + 1, plen - TRACE_EVENT_HEADER, 4);
+        if (events % TRACE_STRIDE == 0)
+        {
+            if (nindex == capindex)
+            {
+                capindex = capindex ? 2 * capindex : 64;
+                index = realloc(index, capindex * sizeof(uint64_t));
+                if (index == NULL)
+                {
+                    fprintf(stderr, "\n Out of memory while converting\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            index[nindex++] = offset;
+        }
+        fwrite(payload, 1, plen, fout);
+        offset += plen;
+        events++;
+    }
+
+    /* Index footer */
+    for (i = 0; i < nindex; i++)
+    {
+        put_le(head, index[i], 8);
+        fwrite(head, 1, 8, fout);
+    }
+    put_le(head, nindex, 8);
+    fwrite(head, 1, 8, fout);
+    put_le(head, events, 8);
+    fwrite(head, 1, 8, fout);
+    put_le(head, TRACE_STRIDE, 4);
+    memcpy(head + 4, TRACE_FOOTER_MAGIC, 4);
+    fwrite(head, 1, 8, fout);
+
+    free(index);
+    free(payload);
+    free(arena.arr);
+    free(reader.buf);
+    fclose(fin);
+    i = ferror(fout);
+    if (fclose(fout) != 0 || i)
+    {
+        perror("Writing binary trace\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Check if a file is a binary trace
+ *
+ * @param path File
+ *
+ * @return 1 if it starts with the binary trace magic
+ *         0 otherwise
+ */
+static int is_binary_trace(const char *path){
+    char magic[4];
+    FILE *f = fopen(path, "rb");
+    int ret;
+    if (f == NULL) return 0;
+    ret = fread(magic, 1, 4, f) == 4 && memcmp(magic, TRACE_MAGIC, 4) == 0;
+    fclose(f);
+    return ret;
+}
+
+/**
+ * @brief Replay a binary trace straight from a read-only mapping of the file
+ *
+ * @param path Binary trace
+ * @param parseOnly Only decode the events and report the decoding speed
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int replay_binary(const char *path, int parseOnly){
+    int fd;
+    struct stat st;
+    const unsigned char *data, *p, *end, *q, *next;
+    size_t size;
+    IntArena arena = { NULL, 0, 0 };
+    unsigned long long events = 0, sum = 0, expected = 0;
+    unsigned int n, i;
+    int value, indexed, ret = EXIT_SUCCESS;
+    double start = now();
+#ifdef DEBUG
+    char *text = NULL;
+    size_t textcap = 0, textlen;
+#endif /* DEBUG */
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "\n Could not open file: %s\n", path);
+        perror("Opening test file\n");
+        if (fd >= 0) close(fd);
+        return EXIT_FAILURE;
+    }
+    size = (size_t)st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Mapping test file\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);
+    arena.cap = 64;
+    arena.arr = malloc(arena.cap * sizeof(int));
+
+    /* Checks the header and finds where the events end */
+    end = data + size;
+    if (size < TRACE_HEADER)
+    {
+        fprintf(stderr, "\n Corrupt binary trace header\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+    if (data[4] != TRACE_VERSION)
+    {
+        fprintf(stderr, "\n Unsupported binary trace version: %d\n", data[4]);
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+    indexed = data[5] & TRACE_INDEXED;
+    if (indexed)
+    {
+        uint64_t nindex;
+        if (size < TRACE_HEADER + TRACE_FOOTER || memcmp(end - 4, TRACE_FOOTER_MAGIC, 4) != 0)
+        {
+            fprintf(stderr, "\n Corrupt binary trace footer\n");
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+        nindex = get_le(end - TRACE_FOOTER, 8);
+        expected = get_le(end - TRACE_FOOTER + 8, 8);
+        if (nindex > (size - TRACE_HEADER - TRACE_FOOTER) / 8)
+        {
+            fprintf(stderr, "\n Corrupt binary trace footer\n");
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+        end -= TRACE_FOOTER + 8 * nindex;
+    }
+
+    for (p = data + TRACE_HEADER; p < end; p = next)
+    {
+        if ((size_t)(end - p) < TRACE_EVENT_HEADER ||
+            get_le(p + 1, 4) > (uint64_t)(end - p - TRACE_EVENT_HEADER))
+        {
+            fprintf(stderr, "\n Truncated event at offset %lu\n", (unsigned long)(p - data));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        next = p + TRACE_EVENT_HEADER + get_le(p + 1, 4);
+        /* Decodes the arguments (the -1 terminator is implied) */
+        n = 0;
+        q = p + TRACE_EVENT_HEADER;
+        while (q < next)
+        {
+            if (n + 1 >= arena.cap)
+            {
+                arena.cap = arena.cap ? 2 * arena.cap : 64;
+                arena.arr = realloc(arena.arr, arena.cap * sizeof(int));
+                if (arena.arr == NULL)
+                {
+                    fprintf(stderr, "\n Out of memory while decoding\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (!varint_get(&q, next, &value)) break;
+            arena.arr[n++] = value;
+        }
+        if (q != next)
+        {
+            fprintf(stderr, "\n Corrupt event at offset %lu\n", (unsigned long)(p - data));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        arena.arr[n++] = -1;
+        events++;
+        if (parseOnly)
+        {
+            if (has_args((char)p[0]))
+                for (i = 0; i < n; i++) sum += (unsigned int)arena.arr[i];
+            continue;
+        }
+#ifdef DEBUG
+        /* Rebuilds the text line for the debugging prints */
+        if (textcap < 2 + 12 * (size_t)n + 2)
+        {
+            textcap = 2 + 12 * (size_t)n + 2;
+            text = realloc(text, textcap);
+        }
+        textlen = 0;
+        text[textlen++] = (char)p[0];
+        for (i = 0; i < n && has_args((char)p[0]); i++)
+        {
+            textlen += (size_t)sprintf(text + textlen, " %d", arena.arr[i]);
+            if (p[0] != 'I' && p[0] != 'S') break;
+        }
+        text[textlen++] = '\n';
+        handle_event((char)p[0], text, textlen, has_args((char)p[0]) ? arena.arr : NULL, n);
+#else /* DEBUG */
+        handle_event((char)p[0], NULL, 0, has_args((char)p[0]) ? arena.arr : NULL, n);
+#endif /* DEBUG */
+    }
+    if (ret == EXIT_SUCCESS && indexed && events != expected)
+    {
+        fprintf(stderr, "\n Binary trace has %llu events, its index says %llu\n", events, expected);
+        ret = EXIT_FAILURE;
+    }
+    if (parseOnly) parse_report(events, size, sum, now() - start);
+
+out:
+#ifdef DEBUG
+    free(text);
+#endif /* DEBUG */
+    free(arena.arr);
+    munmap((void *)data, size);
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Make a socket non-blocking
+ *
+ * @param fd Socket
+ *
+ * @return 0 on success
+ *         -1 on failure
+ */
+static int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief Open a listening or a connected socket
+ *
+ * @param addr A Unix socket path (any address with a '/'), or
+ *             [host]:port for TCP (without a host a server listens on
+ *             every interface and a client connects to the loopback)
+ * @param server Whether to listen on the address instead of connecting
+ *
+ * @return The socket, -1 on failure
+ */
+static int open_socket(const char *addr, int server){
+    struct sockaddr_un un;
+    struct addrinfo hints, *res, *ai;
+    const char *colon = strrchr(addr, ':');
+    char host[256];
+    int fd = -1, one = 1;
+
+    /* Unix socket */
+    if (strchr(addr, '/') != NULL)
+    {
+        if (strlen(addr) >= sizeof(un.sun_path)) return -1;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, addr);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+        if (server) unlink(addr);
+        if (server ? (bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0 || listen(fd, SERVER_BACKLOG) < 0)
+                   : connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /* TCP socket */
+    if (colon == NULL || (size_t)(colon - addr) >= sizeof(host)) return -1;
+    memcpy(host, addr, (size_t)(colon - addr));
+    host[colon - addr] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] ? host : (server ? NULL : "127.0.0.1"), colon + 1, &hints, &res) != 0) return -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+        if (server) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (server ? (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SERVER_BACKLOG) == 0)
+                   : connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Make room in a growable buffer
+ *
+ * @param b Buffer
+ * @param n Bytes needed after its contents
+ */
+static void buffer_reserve(Buffer *b, size_t n){
+    size_t cap = b->cap ? b->cap : SOCKET_READ;
+    char *buf;
+    if (b->len + n <= b->cap) return;
+    /* Drops what was written out before growing */
+    if (b->start > 0)
+    {
+        memmove(b->buf, b->buf + b->start, b->len - b->start);
+        b->len -= b->start;
+        b->start = 0;
+        if (b->len + n <= b->cap) return;
+    }
+    while (b->len + n > cap) cap *= 2;
+    if ((buf = realloc(b->buf, cap)) == NULL)
+    {
+        fprintf(stderr, "\n Out of memory while buffering a connection\n");
+        exit(EXIT_FAILURE);
+    }
+    b->buf = buf;
+    b->cap = cap;
+}
+
+/**
+ * @brief Append bytes to a growable buffer
+ *
+ * @param b Buffer
+ * @param s Bytes
+ * @param n Number of bytes
+ */
+static void buffer_put(Buffer *b, const char *s, size_t n){
+    buffer_reserve(b, n);
+    memcpy(b->buf + b->len, s, n);
+    b->len += n;
+}
+
+/**
+ * @brief Read what a non-blocking socket has into a buffer
+ *
+ * @param fd Socket
+ * @param b Buffer
+ * @param eof Set when the peer closed its side
+ *
+ * @return 0 on success
+ *         -1 on failure
+ */
+static int buffer_read(int fd, Buffer *b, int *eof){
+    ssize_t n;
+    for (;;)
+    {
+        buffer_reserve(b, SOCKET_READ);
+        n = read(fd, b->buf + b->len, b->cap - b->len);
+        if (n > 0)
+        {
+            b->len += (size_t)n;
+        }
+        else if (n == 0)
+        {
+            *eof = 1;
+            return 0;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        else if (errno != EINTR)
+            return -1;
+    }
+}
+
+/**
+ * @brief Write as much of a buffer as a non-blocking socket takes
+ *
+ * @param fd Socket
+ * @param b Buffer (its start moves past what was written)
+ *
+ * @return 0 if all of it was written, 1 if some is left,
+ *         -1 on failure
+ */
+static int buffer_write(int fd, Buffer *b){
+    ssize_t n;
+    while (b->start < b->len)
+    {
+        n = write(fd, b->buf + b->start, b->len - b->start);
+        if (n > 0)
+            b->start += (size_t)n;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+        else if (n == 0 || errno != EINTR)
+            return -1;
+    }
+    b->start = 0;
+    b->len = 0;
+    return 0;
+}
+
+/* Set by SIGINT or SIGTERM to stop the server */
+static volatile sig_atomic_t stopping = 0;
+
+/**
+ * @brief Signal handler: Stops the server after the events being handled
+ *
+ * @param sig Signal
+ */
+static void on_stop(int sig){
+    (void)sig;
+    stopping = 1;
+}
+
+/**
+ * @brief Output sink of the server: Adds an event's output to the
+ *        responses of the connection being served
+ *
+ * @param buf Output
+ * @param len Length of the output
+ * @param ctx The connection
+ */
+static void conn_output(const char *buf, size_t len, void *ctx){
+    buffer_put(&((Conn *)ctx)->out, buf, len);
+}
+
+/**
+ * @brief Publish callback of the server: Reports the insert of a published
+ *        info and answers its command, after the output of its event
+ *
+ * @param iTM Timestamp of arrival
+ * @param iId Identifier of information
+ * @param status 0 if it was inserted, 1 if its id was not unique
+ * @param ctx The connection
+ */
+static void conn_published(int iTM, int iId, int status, void *ctx){
+    published(iTM, iId, status, NULL);
+    if (status == 0)
+        buffer_put(&((Conn *)ctx)->out, "OK\n", 3);
+    else
+        buffer_put(&((Conn *)ctx)->out, "FAILED\n", 7);
+}
+
+/**
+ * @brief Handle the complete commands a connection sent
+ *
+ * Every command is answered with the output of its event followed by a
+ * line "OK" or "FAILED". Published infos are answered when they are
+ * inserted, which is before the next command's event runs, so the
+ * responses stay in order. They stay buffered, so they are written
+ * together. Once the client is done sending, an unterminated last
+ * command is complete too.
+ *
+ * @param c Connection
+ * @param arena Storage for the arguments
+ */
+static void conn_commands(Conn *c, IntArena *arena){
+    char *line, *nl;
+    size_t start = 0, len;
+    unsigned int n;
+    int *args, ret;
+    Output_Sink(conn_output, c);
+    on_published = conn_published;
+    published_ctx = c;
+    while (start < c->in.len)
+    {
+        line = c->in.buf + start;
+        nl = memchr(line, '\n', c->in.len - start);
+        /* The last command may miss its newline once the client is done,
+         * as the last line of a file may */
+        if (nl == NULL && !c->eof) break;
+        len = (nl != NULL) ? (size_t)(nl - line) + 1 : c->in.len - start;
+        start += len;
+        args = NULL;
+        n = 0;
+        if (has_args(line[0]))
+        {
+            arena->size = 0;
+            args = event_args(line, len, &n, arena);
+        }
+        ret = handle_event(line[0], line, len, args, n);
+        if (ret == 0)
+            buffer_put(&c->out, "OK\n", 3);
+        else if (ret != EVENT_QUEUED)
+            buffer_put(&c->out, "FAILED\n", 7);
+    }
+    /* Published infos are inserted and answered before the responses go out */
+    drain_published();
+    on_published = published;
+    published_ctx = NULL;
+    Output_Sink(NULL, NULL);
+    memmove(c->in.buf, c->in.buf + start, c->in.len - start);
+    c->in.len -= start;
+}
+
+/**
+ * @brief Close a connection of the server
+ *
+ * @param ep Epoll instance
+ * @param c Connection
+ * @param conns List of the connections
+ */
+static void conn_close(int ep, Conn *c, Conn **conns){
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->prev != NULL) c->prev->next = c->next;
+    else *conns = c->next;
+    if (c->next != NULL) c->next->prev = c->prev;
+    free(c->in.buf);
+    free(c->out.buf);
+    free(c);
+}
+
+/**
+ * @brief Serve the event commands of clients until SIGINT or SIGTERM
+ *
+ * A single thread waits on all the sockets with epoll. Each connection
+ * sends lines in the input file's format, as many at a time as it likes.
+ * All the complete lines of a read are handled in order, and their
+ * responses are sent back with as few writes as the socket allows.
+ *
+ * @param addr Address to listen on
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int serve(const char *addr){
+    struct epoll_event ev, events[SOCKET_EVENTS];
+    struct sigaction sa;
+    IntArena arena = { NULL, 0, 0 };
+    Conn *c, *conns = NULL;
+    int ep, lfd, fd, i, n, w, want, ret = EXIT_SUCCESS;
+
+    if ((lfd = open_socket(addr, 1)) < 0 || set_nonblocking(lfd) < 0 || (ep = epoll_create1(0)) < 0)
+    {
+        fprintf(stderr, "\n Could not listen on: %s\n", addr);
+        perror("Opening server socket\n");
+        if (lfd >= 0) close(lfd);
+        return EXIT_FAILURE;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    while (!stopping)
+    {
+        n = epoll_wait(ep, events, SOCKET_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            perror("Waiting on the server sockets\n");
+            ret = EXIT_FAILURE;
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            /* New connections */
+            if (c == NULL)
+            {
+                while ((fd = accept(lfd, NULL, NULL)) >= 0)
+                {
+                    if (set_nonblocking(fd) < 0 || (c = calloc(1, sizeof(Conn))) == NULL)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    c->fd = fd;
+                    c->events = EPOLLIN;
+                    c->next = conns;
+                    if (conns != NULL) conns->prev = c;
+                    conns = c;
+                    ev.events = c->events;
+                    ev.data.ptr = c;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                if (buffer_read(c->fd, &c->in, &c->eof) < 0)
+                {
+                    conn_close(ep, c, &conns);
+                    continue;
+                }
+                conn_commands(c, &arena);
+            }
+            w = buffer_write(c->fd, &c->out);
+            if (w < 0 || (w == 0 && c->eof))
+            {
+                conn_close(ep, c, &conns);
+                continue;
+            }
+            /* Stops reading a client that doesn't take its responses */
+            want = (c->eof || c->out.len - c->out.start >= SOCKET_PENDING ? 0 : EPOLLIN) | (w > 0 ? EPOLLOUT : 0);
+            if (want != c->events)
+            {
+                c->events = want;
+                ev.events = (uint32_t)want;
+                ev.data.ptr = c;
+                epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+            }
+        }
+    }
+
+    while (conns != NULL) conn_close(ep, conns, &conns);
+    close(ep);
+    close(lfd);
+    if (strchr(addr, '/') != NULL) unlink(addr);
+    free(arena.arr);
+    return ret;
+}
+
+/**
+ * @brief Order latencies for qsort
+ *
+ * @param a First latency
+ * @param b Second latency
+ *
+ * @return <0, 0 or >0 as a is smaller, equal or larger
+ */
+static int compare_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Load generator: Send the lines of an input file to a server and
+ *        report the requests per second and the latencies
+ *
+ * The lines are dealt round robin to the connections. Each connection
+ * keeps up to depth commands in flight, and a command's latency runs
+ * from when it is queued for sending until its "OK" or "FAILED" line
+ * arrives. The server's output is expected in the text or JSON format.
+ *
+ * @param addr Address of the server
+ * @param conns Number of connections
+ * @param depth Commands in flight per connection
+ * @param path Input file
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+static int load(const char *addr, int conns, int depth, const char *path){
+    struct epoll_event ev, events[SOCKET_EVENTS];
+    struct sigaction sa;
+    FILE *fin;
+    LineReader reader;
+    Buffer text = { NULL, 0, 0, 0 }, in = { NULL, 0, 0, 0 };
+    size_t *lines = NULL, nlines = 0, linecap = 0, done = 0, failed = 0, len, p;
+    double *lat = NULL, start, secs;
+    Client *cl = NULL, *c;
+    char *line;
+    int ep = -1, i, n, eof, w, want, ret = EXIT_FAILURE;
+
+    if (conns <= 0 || depth <= 0)
+    {
+        fprintf(stderr, "\n Invalid connections (%d) or depth (%d)\n", conns, depth);
+        return EXIT_FAILURE;
+    }
+    if ((fin = fopen(path, "r")) == NULL || reader_init(&reader, fin))
+    {
+        fprintf(stderr, "\n Could not open file: %s\n", path);
+        perror("Opening test file\n");
+        if (fin != NULL) fclose(fin);
+        return EXIT_FAILURE;
+    }
+    /* Every non empty line is a command (newline terminated) */
+    while ((line = read_line(&reader, &len)) != NULL)
+    {
+        if (line[0] == '\n' || line[0] == '\r') continue;
+        if (nlines + 1 >= linecap)
+        {
+            size_t *grown;
+            linecap = linecap ? 2 * linecap : 1024;
+            if ((grown = realloc(lines, linecap * sizeof(size_t))) == NULL)
+            {
+                fprintf(stderr, "\n Out of memory while reading the commands\n");
+                exit(EXIT_FAILURE);
+            }
+            lines = grown;
+        }
+        lines[nlines++] = text.len;
+        buffer_put(&text, line, len);
+        if (line[len - 1] != '\n') buffer_put(&text, "\n", 1);
+    }
+    free(reader.buf);
+    fclose(fin);
+    if (nlines == 0)
+    {
+        fprintf(stderr, "\n No commands in: %s\n", path);
+        goto out;
+    }
+    lines[nlines] = text.len;
+    lat = malloc(nlines * sizeof(double));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    if ((ep = epoll_create1(0)) < 0 || (cl = calloc((size_t)conns, sizeof(Client))) == NULL) goto out;
+    for (i = 0; i < conns; i++)
+    {
+        cl[i].fd = -1;
+        cl[i].sent = malloc((size_t)depth * sizeof(double));
+        cl[i].next = cl[i].acked = (size_t)i;
+    }
+    start = now();
+    for (i = 0; i < conns; i++)
+    {
+        if ((cl[i].fd = open_socket(addr, 0)) < 0 || set_nonblocking(cl[i].fd) < 0)
+        {
+            fprintf(stderr, "\n Could not connect to: %s\n", addr);
+            perror("Connecting to the server\n");
+            goto out;
+        }
+        cl[i].events = 0;
+        ev.events = 0;
+        ev.data.ptr = &cl[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, cl[i].fd, &ev);
+    }
+
+    for (;;)
+    {
+        for (i = 0; i < conns; i++)
+        {
+            c = &cl[i];
+            /* Queues commands while fewer than depth are in flight */
+            while (c->next < nlines && (c->next - c->acked) / (size_t)conns < (size_t)depth)
+            {
+                c->sent[(c->next / (size_t)conns) % (size_t)depth] = now();
+                buffer_put(&c->out, text.buf + lines[c->next], lines[c->next + 1] - lines[c->next]);
+                c->next += (size_t)conns;
+            }
+            if ((w = buffer_write(c->fd, &c->out)) < 0)
+            {
+                perror("Sending commands\n");
+                goto out;
+            }
+            want = (c->acked < nlines ? EPOLLIN : 0) | (w > 0 ? EPOLLOUT : 0);
+            if (want != c->events)
+            {
+                c->events = want;
+                ev.events = (uint32_t)want;
+                ev.data.ptr = c;
+                epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+            }
+        }
+        if (done == nlines) break;
+        n = epoll_wait(ep, events, SOCKET_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            perror("Waiting on the client sockets\n");
+            goto out;
+        }
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+            in.len = 0;
+            eof = 0;
+            if (buffer_read(c->fd, &in, &eof) < 0 || (eof && c->acked < nlines && in.len == 0))
+            {
+                fprintf(stderr, "\n The server closed a connection\n");
+                goto out;
+            }
+            /* Finds the status lines among the output of the events */
+            for (p = 0; p < in.len; p++)
+            {
+                if (in.buf[p] != '\n')
+                {
+                    if (c->statuslen < sizeof(c->status) - 1) c->status[c->statuslen] = in.buf[p];
+                    c->statuslen++;
+                    continue;
+                }
+                if (c->statuslen < sizeof(c->status)) c->status[c->statuslen] = '\0';
+                if (c->statuslen < sizeof(c->status) &&
+                    (strcmp(c->status, "OK") == 0 || strcmp(c->status, "FAILED") == 0) && c->acked < nlines)
+                {
+                    failed += c->status[0] == 'F';
+                    lat[done++] = now() - c->sent[(c->acked / (size_t)conns) % (size_t)depth];
+                    c->acked += (size_t)conns;
+                }
+                c->statuslen = 0;
+            }
+        }
+    }
+    secs = now() - start;
+
+    qsort(lat, nlines, sizeof(double), compare_double);
+    printf("%zu requests over %d connections (depth %d) in %.3f s: %.0f requests/s\n"
+           "latency p50 %.1f us, p99 %.1f us, max %.1f us, %zu failed\n",
+           nlines, conns, depth, secs, nlines / secs,
+           lat[nlines / 2] * 1e6, lat[nlines * 99 / 100] * 1e6, lat[nlines - 1] * 1e6, failed);
+    ret = EXIT_SUCCESS;
+
+out:
+    for (i = 0; cl != NULL && i < conns; i++)
+    {
+        if (cl[i].fd >= 0) close(cl[i].fd);
+        free(cl[i].sent);
+        free(cl[i].out.buf);
+    }
+    free(cl);
+    if (ep >= 0) close(ep);
+    free(lat);
+    free(lines);
+    free(text.buf);
+    free(in.buf);
+    return ret;
+}
+
+/**
+ * @brief The main function
+ *
+ * @param argc Number of arguments
+ * @param argv Argument vector
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+int main(int argc, char **argv)
+{
+	FILE *fin = NULL;
+	char *buff;
+	size_t len;
+	LineReader reader;
+	IntArena arena = { NULL, 0, 0 };
+	int parseOnly = 0, useMmap = 0, threads = 0;
+	const char *serveAddr = NULL, *loadAddr = NULL;
+	Config cfg;
+	unsigned int num_of_args;
+	int * event_args_arr;
+
+	/* Convert a text trace to the binary format */
+	if (argc == 4 && strcmp(argv[1], "--convert") == 0)
+	{
+		return convert_trace(argv[2], argv[3]);
+	}
+
+	/* Check command buff arguments */
+	cfg.groups = MG;
+	cfg.pools = 1;
+	cfg.output = OUTPUT_TEXT;
+	cfg.prune_dump = 0;
+	cfg.consume_merge = 0;
+	cfg.fast_exit = 0;
+	cfg.threadsafe = 0;
+	cfg.prune_threads = 0;
+	cfg.publish = 0;
+	while (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+	{
+		if (strcmp(argv[1], "--parse-only") == 0)
+			parseOnly = 1;
+		else if (strcmp(argv[1], "--prune-dump") == 0)
+			cfg.prune_dump = 1;
+		else if (strcmp(argv[1], "--merge") == 0)
+			cfg.consume_merge = 1;
+		else if (strcmp(argv[1], "--fast-exit") == 0)
+			cfg.fast_exit = 1;
+		else if (strcmp(argv[1], "--threadsafe") == 0)
+			cfg.threadsafe = 1;
+		else if (strncmp(argv[1], "--prune-threads=", 16) == 0)
+			cfg.prune_threads = atoi(argv[1] + 16);
+		else if (strncmp(argv[1], "--serve=", 8) == 0)
+			serveAddr = argv[1] + 8;
+		else if (strncmp(argv[1], "--load=", 7) == 0)
+			loadAddr = argv[1] + 7;
+		else if (strncmp(argv[1], "--publish=", 10) == 0)
+			cfg.publish = atoi(argv[1] + 10);
+		else if (strcmp(argv[1], "--quiet") == 0)
+			cfg.output = OUTPUT_NONE;
+		else if (strcmp(argv[1], "--format=text") == 0)
+			cfg.output = OUTPUT_TEXT;
+		else if (strcmp(argv[1], "--format=json") == 0)
+			cfg.output = OUTPUT_JSON;
+		else if (strcmp(argv[1], "--format=binary") == 0)
+			cfg.output = OUTPUT_BINARY;
+		else if (strcmp(argv[1], "--mmap") == 0)
+			useMmap = 1;
+		else if (strncmp(argv[1], "--mmap=", 7) == 0)
+		{
+			useMmap = 1;
+			threads = atoi(argv[1] + 7);
+		}
+		else
+			break;
+		argv++;
+		argc--;
+	}
+	publishing = cfg.publish > 0 && !parseOnly;
+
+	/* Load generator for the server mode */
+	if (loadAddr != NULL && argc == 4)
+	{
+		return load(loadAddr, atoi(argv[1]), atoi(argv[2]), argv[3]);
+	}
+
+	if (argc != (serveAddr != NULL ? 3 : 4) || loadAddr != NULL)
+	{
+		fprintf(stderr, "Usage: %s [--parse-only] [--mmap[=<threads>]] [--format=text|json|binary] [--quiet]\n"
+		                "          [--prune-dump] [--merge] [--fast-exit] [--threadsafe]\n"
+		                "          [--prune-threads=<n>] [--publish=<capacity>] <m> <p> <input_file>\n"
+		                "       %s --serve=<address> [options] <m> <p>\n"
+		                "       %s --load=<address> <connections> <depth> <input_file>\n"
+		                "       %s --convert <text_file> <binary_file>\n"
+		                "An address is [host]:port for TCP or the path of a Unix socket\n",
+		                argv[0], argv[0], argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Parse command buff arguments */
+	int hashTableSize = atoi(argv[1]);
+	int universalHashingNumber = atoi(argv[2]);
+
+	if (hashTableSize <= 0)
+	{
+		fprintf(stderr, "\n Invalid hash table size: %d\n", hashTableSize);
+		perror("Parsing command line argument\n");
+		return EXIT_FAILURE;
+	}
+
+	if (universalHashingNumber <= 0)
+	{
+		fprintf(stderr, "\n Invalid universal hashing number: %d\n", universalHashingNumber);
+		perror("Parsing command line argument\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Commands from clients instead of a file */
+	if (serveAddr != NULL)
+	{
+		int ret;
+		initialize_config(hashTableSize, universalHashingNumber, &cfg);
+		ret = serve(serveAddr);
+		free_all();
+		return ret;
+	}
+
+	/* Binary trace (always memory mapped) */
+	if (is_binary_trace(argv[3]))
+	{
+		int ret;
+		if (!parseOnly) initialize_config(hashTableSize, universalHashingNumber, &cfg);
+		ret = replay_binary(argv[3], parseOnly);
+		drain_published();
+		if (!parseOnly) free_all();
+		return ret;
+	}
+
+	/* Memory mapped input with parallel parsing */
+	if (useMmap)
+	{
+		int ret;
+		if (!parseOnly) initialize_config(hashTableSize, universalHashingNumber, &cfg);
+		ret = replay_mmap(argv[3], threads, parseOnly);
+		drain_published();
+		if (!parseOnly) free_all();
+		return ret;
+	}
+
+	/* Open input file */
+	if ((fin = fopen(argv[3], "r")) == NULL)
+	{
+		fprintf(stderr, "\n Could not open file: %s\n", argv[3]);
+		perror("Opening test file\n");
+		return EXIT_FAILURE;
+	}
+	if (reader_init(&reader, fin))
+	{
+		fprintf(stderr, "\n Could not allocate the input buffer\n");
+		fclose(fin);
+		return EXIT_FAILURE;
+	}
+
+	/* Parse-only benchmark */
+	if (parseOnly)
+	{
+		int ret = parse_only(&reader, &arena);
+		free(arena.arr);
+		free(reader.buf);
+		fclose(fin);
+		return ret;
+	}
+
+	/* Initializations */
+	initialize_config(hashTableSize, universalHashingNumber, &cfg);
+
+	/* Read input file buff-by-buff and handle the events */
+	while ((buff = read_line(&reader, &len)) != NULL)
+	{
+		event_args_arr = NULL;
+		num_of_args = 0;
+		if (has_args(buff[0]))
+		{
+			arena.size = 0;
+			event_args_arr = event_args(buff, len, &num_of_args, &arena);
+		}
+		handle_event(buff[0], buff, len, event_args_arr, num_of_args);
 	}
 
+	drain_published();
 	free_all();
+	free(arena.arr);
+	free(reader.buf);
+	fclose(fin);
 	return (EXIT_SUCCESS);
 }
@@ -14,52 +14,125 @@
  ***************************************************************
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "pss.h"
+static Engine ENGINE; // Driven by the threads that did not pick another one
+static __thread Engine *E = &ENGINE; // The calling thread's engine
 
-struct Group G[MG];
-struct SubInfo *HT[MG];
-static int P;
-static int M;
-static int A;
-static int B;
-
-bool Info_isUnique_iId(int id, int tm);
+bool Info_isUnique_iId(int id);
 bool Subscriber_isUnique_sId(int id);
 Sub* Subscriber_Insert(Sub* List, int id);
 Sub* Subscriber_Delete(Sub* List, int id);
 SubInfo *SubInfo_Insert(SubInfo *List, int tm, int id, int *gids_arr, int size_of_gids_arr);
-bool SubInfo_Interested(const int* gids_arr, int size_of_gids_arr, int k);
+int Group_Register(int gid);
+int Group_Slot(int gid);
+void Registry_Free(void);
+GroupSet *GroupSet_New(const int *gids_arr, int size_of_gids_arr, int n);
+void GroupSet_Release(GroupSet *set);
+bool SubInfo_Matches(SubInfo *sub, Info *info);
 SubInfo *SubInfo_Delete(SubInfo *List, int id);
-TreeInfo* ConsumeInfo(TreeInfo *info, TreeInfo *end);
+void SubInfo_Free(SubInfo *p);
+void ConsumeInfo(SubGroup *sg);
+long SubGroup_Next(const SubGroup *sg);
 void Insert_Info_Print(int iTM,int iId, const int *gids_arr, int size_of_gids_arr);
-void Delete_Subscriber_Print(int sId, Info **gids_arr);
-void Subscriber_Registration_Print(int sTM, int sId, int *gids_arr, int size_of_gids_arr);
-void Consume_Print(SubInfo* sub, TreeInfo** preConsume);
-void Consume_Print_Info(TreeInfo *info, TreeInfo *end);
+void Delete_Subscriber_Print(int sId, SubGroup *sgs, int sgn);
+void Subscriber_Registration_Print(SubInfo *sub);
+void Consume_Print(SubGroup *sg, long preConsume);
+void Consume_Print_Info(Group *g, long hi, long lo);
 SubInfo *getSub(int id);
-void filterArray(int *gids_arr, int *size_of_gids_arr);
+int filterArray(int *gids_arr, int *size_of_gids_arr);
 bool isSubValid(int sId);
 void Hash_Insert(int sTM, int sId, int *gids_arr, int size_of_gids_arr);
-Info* Info_Insert(Info* T, int tm, int id, int* gids_arr, int size_of_gids_arr);
+Info* Info_Insert(Info* T, int tm, int id, GroupSet *igp);
 void printGroupInfo(Info *T);
-int Universal_Hash_Function(int x);
+void Hash_Init(int m);
+int Universal_Hash_Function(HashTable *t, int x);
+SubInfo *Hash_First(HashIter *it);
+SubInfo *Hash_Next(HashIter *it);
+void Hash_Free(void);
 SubInfo* Hash_LookUp(int id);
 void Hash_Delete(int id);
-TreeInfo* Consumption_Insert(TreeInfo* T, int id, int tm, SubInfo* sub, int k);
-void pruneTree(Info *T, int tm, int k);
+void Hash_RehashStep(int n);
+void pruneTree(int tm, int k, PruneResult *res);
+int Prune_Dump(int tm);
+void Prune_Print(const PruneResult *res);
+void Heap_Push(Group *g, int tm, int id);
+TimeEntry Heap_Pop(Group *g);
 Info* Info_LookUp(Info* T, int id);
 Info* Info_Delete(Info* T, int id);
 int random(int min, int max);
-void Consumption_Print(TreeInfo* T);
+void Consumption_Print(Group *g, long from);
 void freeInfo(Info *T);
 void freeSub(Sub *T);
-void freeConsumption(TreeInfo *T);
-TreeInfo* Consumption_LookUp(TreeInfo* T, int tm, int id);
+void Log_Init(Group *g);
+void Log_Append(Group *g, int id, int tm);
+void Log_Repin(Group *g, LogSegment **pin);
+void Log_Advance(LogSegment **pin, long off);
+void Log_Runs(LogSegment *seg, long from, long to, int gId, ConsumeCallback cb, void *ctx);
+void Log_Reclaim(Group *g);
+TimeEntry *Log_At(LogSegment *seg, long off);
+void Log_Free(Group *g);
+void Merge_Start(Merge *h, SubInfo *sub);
+bool Merge_Next(Merge *h, SubInfo *sub, Delivery *d);
+void Merge_Free(Merge *h);
+void Index_Init(int cap);
+void Index_Acquire(int id);
+void Index_Release(int id);
+bool Index_Contains(int id);
+void Index_Free(void);
+void Pools_Init(int enabled);
+void Pools_Release(void);
+void *Mem_Alloc(Pool *pool);
+void Mem_Free(Pool *pool, void *p);
+void *Mem_AllocSize(size_t size);
+void Mem_FreeSize(void *p, size_t size);
+void Out_Init(int format);
+void Out_Free(void);
+void Out_Begin(char event);
+void Out_End(void);
+void Out_Text(const char *s);
+void Out_Int(const char *key, int v);
+void Out_Long(const char *key, long v);
+void Out_Item(int v);
+void Out_Open(const char *key, char kind);
+void Out_Close(void);
+void Prune_Groups(int tm, PruneResult *res);
+void Prune_Parallel(int tm, PruneResult *res);
+void Engine_Lock(int exclusive);
+void Engine_LockGroups(const int *gids_arr, int size_of_gids_arr);
+void Engine_Unlock(void);
+void Group_Lock(Group *g);
+void Group_Unlock(Group *g);
+void Index_Lock(void);
+void Index_Unlock(void);
+void Pools_Lock(void);
+void Pools_Unlock(void);
+void Sub_LockGroups(SubInfo *sub);
+void Sub_UnlockGroups(SubInfo *sub);
+Local *Local_Get(void);
+void Locks_Init(void);
+void Locks_Free(void);
+Merge *Merge_Self(void);
+void Prune_Start(int threads);
+void Prune_Stop(void);
+void Publish_Init(int capacity);
+void Publish_Free(void);
+void Info_Add(int iTM, int iId, int *gids_arr, int size_of_gids_arr);
+int Watch_Collect(Notice **calls);
+void Watch_Stop(SubInfo *sub);
+void Watch_Fire(Notice *calls, int n);
+void Ready_Free(void);
 
 /**
  * @brief Optional function to initialize data structures that
@@ -72,18 +145,62 @@ TreeInfo* Consumption_LookUp(TreeInfo* T, int tm, int id);
  *         1 on failure
  */
 int initialize(int m, int p){
+    Config cfg;
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_TEXT;
+    cfg.prune_dump = 0;
+    cfg.consume_merge = 0;
+    cfg.fast_exit = 0;
+    cfg.threadsafe = 0;
+    cfg.prune_threads = 0;
+    cfg.publish = 0;
+    return initialize_config(m, p, &cfg);
+}
+
+/**
+ * @brief Initialize data structures with a custom configuration
+ *
+ * @param m Size of the hash table.
+ * @param p Prime number for the universal hash functions.
+ * @param cfg Configuration
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+int initialize_config(int m, int p, const Config *cfg){
     int i;
+    // Checks
+    if (m <= 0 || p <= 0) return EXIT_FAILURE;
     // Initializes Hash parameters
-    P = p;
-    M = m;
-    A = random(1, P-1);
-    B = random(0, P-1);
-    // Initializes G
-    for (i=0; i<MG; i++) {
-        G[i].gId=i;
-        G[i].gr=NULL;
-        G[i].gsub=NULL;
-    }
+    E->P = p;
+    E->M = m;
+    E->SEED = (unsigned int) time(0);
+    E->A = random(1, E->P-1);
+    E->B = random(0, E->P-1);
+    E->THREADSAFE = cfg->threadsafe;
+    E->LEAF_LOCKING = E->THREADSAFE;
+    Locks_Init();
+    // Initializes node allocators
+    Pools_Init(cfg->pools);
+    // Initializes output writer
+    Out_Init(cfg->output);
+    E->PRUNE_DUMP = cfg->prune_dump;
+    E->CONSUME_MERGE = cfg->consume_merge;
+    E->FAST_EXIT = cfg->fast_exit;
+    Prune_Start(cfg->prune_threads);
+    Publish_Init(cfg->publish);
+    E->RL.fd = -1; // Until Ready_Fd() is called
+    // Initializes G (More groups are registered on demand)
+    E->REG.keys = NULL;
+    E->REG.cap = 0;
+    E->REG.size = 0;
+    for (i=0; i<cfg->groups; i++)
+        Group_Register(i);
+    // Initializes Hash Table
+    Hash_Init(E->M);
+    // Initializes info id index
+    Index_Init(MG);
     return EXIT_SUCCESS;
 }
 
@@ -94,32 +211,91 @@ int initialize(int m, int p){
  *         1 on failure
  */
 int free_all(void){
-    int i, j;
+    int i;
     SubInfo *p, *next;
-    for (i=0; i<MG; i++) {
+    HashIter it;
+    // The OS takes the whole heap back at exit, only output must not be lost
+    if (E->FAST_EXIT) {
+        Out_Free();
+        return EXIT_SUCCESS;
+    }
+    Prune_Stop();
+    Publish_Free();
+    Ready_Free();
+    for (i=0; i<E->GN; i++) {
+        // Free group's time index and watchers
+        free(E->G[i].gheap);
+        free(E->G[i].gwatchers);
+        // Free group's lock
+        if (E->G[i].glock != NULL) {
+            pthread_mutex_destroy(E->G[i].glock);
+            free(E->G[i].glock);
+        }
+        // Pooled nodes are released in bulk below
+        if (E->PS.enabled) continue;
         // Free group's info tree
-        freeInfo(G[i].gr);
-        G[i].gr=NULL;
+        freeInfo(E->G[i].gr);
+        // Free group's delivery log
+        Log_Free(&E->G[i]);
         // Free group's sub list
-        freeSub(G[i].gsub);
+        freeSub(E->G[i].gsub);
     }
+    free(E->G);
+    E->G=NULL;
+    E->GN=0;
+    E->GCAP=0;
+    Registry_Free();
     // Free subinfo tree
-    for (i = 0; i<M; i++) {
-        p = HT[i]; // For each HT chain
-        while (p!=NULL) { // Free sub info
-            next=p->snext;
-            for (j=0; j<MG; j++) { // Free Consumption Tree
-                if (p->tgp[j]!=NULL && p->tgp[j]!= (TreeInfo*) 1) {
-                    freeConsumption(p->tgp[i]);
-                }
-            }
-            free(p); // Free Sub Info
-            p=next;
-        }
+    p = E->PS.enabled ? NULL : Hash_First(&it);
+    while (p!=NULL) { // Free sub info
+        next=Hash_Next(&it);
+        SubInfo_Free(p); // Free Sub Info
+        p=next;
     }
+    Hash_Free();
+    // Free info id index
+    Index_Free();
+    // Free node pools
+    Pools_Release();
+    // Writes pending output
+    Out_Free();
+    PruneResult_Free(&E->PR);
+    Merge_Free(&E->MH);
+    // Frees every thread's state
+    Locks_Free();
+    // Leaves the engine as it was before initialize
+    memset(E, 0, sizeof(Engine));
     return EXIT_SUCCESS;
 }
 
+Engine *Engine_New(int m, int p, const Config *cfg){
+    Engine *e = (Engine*) calloc(1, sizeof(Engine)), *prev = E;
+    if (e == NULL) return NULL;
+    E = e;
+    if (initialize_config(m, p, cfg) != EXIT_SUCCESS) {
+        free(e);
+        e = NULL;
+    }
+    E = prev;
+    return e;
+}
+
+void Engine_Use(Engine *e){
+    E = (e != NULL) ? e : &ENGINE;
+}
+
+int Engine_Free(Engine *e){
+    Engine *prev = (E == e) ? &ENGINE : E;
+    int ret, fast;
+    E = e;
+    fast = E->FAST_EXIT;
+    ret = free_all();
+    E = prev;
+    // Fast exit leaves the memory to the process' exit, the engine too
+    if (!fast) free(e);
+    return ret;
+}
+
 /**
  * @brief Insert info
  *
@@ -131,18 +307,53 @@ int free_all(void){
  *          1 on failure
  */
 int Insert_Info(int iTM,int iId,int* gids_arr,int size_of_gids_arr){
-    int i;
     // Checks & fixes
-    if (iTM<0 || iId<0 || size_of_gids_arr<=0 || !Info_isUnique_iId(iId, iTM)) return EXIT_FAILURE;
-    filterArray(gids_arr, &size_of_gids_arr);
+    if (iTM<0 || iId<0 || size_of_gids_arr<=0) return EXIT_FAILURE;
+    Engine_LockGroups(gids_arr, size_of_gids_arr);
+    // Claims the id at once, so a concurrent insert of it fails
+    Index_Lock();
+    if (!Info_isUnique_iId(iId)) {
+        Index_Unlock();
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
+    Index_Acquire(iId);
+    Index_Unlock();
+    Info_Add(iTM, iId, gids_arr, size_of_gids_arr);
+    Engine_Unlock();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Inserts an info whose id was claimed in the index into its groups
+ * @param iTM Info tm
+ * @param iId Info id
+ * @param gids_arr Groups of the info
+ * @param size_of_gids_arr Size of gids_arr including -1
+ */
+void Info_Add(int iTM, int iId, int *gids_arr, int size_of_gids_arr) {
+    int i, n;
+    GroupSet *igp;
+    n = filterArray(gids_arr, &size_of_gids_arr);
+    // Group list shared by all copies of the info
+    igp = GroupSet_New(gids_arr, size_of_gids_arr, n);
     // Insert info in groups of gids_arr
     for (i=0; i<size_of_gids_arr; i++) {
-        if (gids_arr[i]!=-2)
-            G[gids_arr[i]].gr= Info_Insert(G[gids_arr[i]].gr, iTM, iId, gids_arr, size_of_gids_arr);
+        if (gids_arr[i]!=-2) {
+            Group_Lock(&E->G[gids_arr[i]]);
+            E->G[gids_arr[i]].gr= Info_Insert(E->G[gids_arr[i]].gr, iTM, iId, igp);
+            Heap_Push(&E->G[gids_arr[i]], iTM, iId);
+            Group_Unlock(&E->G[gids_arr[i]]);
+        }
     }
+    GroupSet_Release(igp);
+    // One reference per group copy (the claim was the first one)
+    Index_Lock();
+    if (n==0) Index_Release(iId);
+    for (i=1; i<n; i++) Index_Acquire(iId);
+    Index_Unlock();
     // Print
     Insert_Info_Print(iTM, iId, gids_arr, size_of_gids_arr);
-    return EXIT_SUCCESS;
 }
 /**
  * @brief Subsriber Registration
@@ -157,16 +368,22 @@ int Insert_Info(int iTM,int iId,int* gids_arr,int size_of_gids_arr){
 int Subscriber_Registration(int sTM,int sId,int* gids_arr,int size_of_gids_arr) {
     int i;
     // Checks & fixes
-    if (sTM<0 || sId <0 || size_of_gids_arr<=0 || !Subscriber_isUnique_sId(sId)) return EXIT_FAILURE;
+    if (sTM<0 || sId <0 || size_of_gids_arr<=0) return EXIT_FAILURE;
+    Engine_Lock(1);
+    if (!Subscriber_isUnique_sId(sId)) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
     filterArray(gids_arr, &size_of_gids_arr);
     // Insert subscriber in groups of gids_arr
     for (i=0; i<size_of_gids_arr; i++) {
-        if (gids_arr[i]!=-2) G[gids_arr[i]].gsub=Subscriber_Insert(G[gids_arr[i]].gsub, sId);
+        if (gids_arr[i]!=-2) E->G[gids_arr[i]].gsub=Subscriber_Insert(E->G[gids_arr[i]].gsub, sId);
     }
     // Insert subscriber in Hash Table
     Hash_Insert(sTM, sId, gids_arr, size_of_gids_arr);
     // Print
-    Subscriber_Registration_Print(sTM, sId, gids_arr, size_of_gids_arr);
+    Subscriber_Registration_Print(Hash_LookUp(sId));
+    Engine_Unlock();
     return EXIT_SUCCESS;
 }
 /**
@@ -177,48 +394,132 @@ int Subscriber_Registration(int sTM,int sId,int* gids_arr,int size_of_gids_arr)
  *          1 on failure
  */
 int Prune(int tm){
+    Notice *calls;
+    int n;
+    // Checks
+    if (tm<0) return EXIT_FAILURE;
+    Engine_Lock(1);
+    if (E->OUT.format==OUTPUT_NONE) {
+        // Nothing to render
+        Prune_Groups(tm, NULL);
+    } else if (E->PRUNE_DUMP) {
+        // Whole system, only when asked for
+        Prune_Dump(tm);
+    } else {
+        // What this prune changed
+        Prune_Groups(tm, &E->PR);
+        Prune_Print(&E->PR);
+    }
+    n = Watch_Collect(&calls);
+    Engine_Unlock();
+    // Callbacks may consume now
+    Watch_Fire(calls, n);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Prune Information and report only what changed
+ *
+ * @param tm Information timestamp of arrival
+ * @param res Result (reused across calls)
+ * @return 0 on success
+ *          1 on failure
+ */
+int Prune_Delta(int tm, PruneResult *res){
+    Notice *calls;
+    int n;
+    // Checks
+    if (tm<0) return EXIT_FAILURE;
+    Engine_Lock(1);
+    Prune_Groups(tm, res);
+    n = Watch_Collect(&calls);
+    Engine_Unlock();
+    Watch_Fire(calls, n);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Free a prune result
+ *
+ * @param res Result
+ */
+void PruneResult_Free(PruneResult *res){
+    free(res->groups);
+    free(res->moves);
+    free(res->subs);
+    memset(res, 0, sizeof(*res));
+}
+
+/**
+ * @brief Prune Information and print the whole system
+ *
+ * @param tm Information timestamp of arrival
+ * @return 0 on success
+ *          1 on failure
+ */
+int Prune_Dump(int tm){
     int i, j;
     SubInfo *p;
+    HashIter it;
     Info* info;
     Sub* sub;
-    // Checks
-    if (tm<0) return EXIT_FAILURE;
-    // Printing is done simultaneously
-    printf("R DONE\n");
-    for (i = 0; i < MG; i++) {
+    // Groups are independent, so they can all be pruned before printing
+    Prune_Groups(tm, NULL);
+    Out_Begin('R');
+    Out_Text("R DONE\n");
+    Out_Open("groups", '[');
+    for (i = 0; i < E->GN; i++) {
         // Prune for Group
-        printf("    GROUPID = %d, ", G[i].gId);
-        pruneTree(G[i].gr, tm, i);
+        Out_Open(NULL, '{');
+        Out_Text("    GROUPID = ");
+        Out_Int("gid", E->G[i].gId);
+        Out_Text(", ");
         // Print new group info list
-        printf("INFOLIST:");
-        info = G[i].gr;
+        Out_Text("INFOLIST:");
+        Out_Open("infos", '[');
+        info = E->G[i].gr;
         printGroupInfo(info);
+        Out_Close();
         // Print group sub list
-        printf(", SUBLIST: ");
-        sub = G[i].gsub;
+        Out_Text(", SUBLIST: ");
+        Out_Open("subs", '[');
+        sub = E->G[i].gsub;
         while (sub!=NULL) {
-            printf("%d ", sub->sId);
+            Out_Int(NULL, sub->sId);
+            Out_Text(" ");
             sub=sub->snext;
         }
-        printf("\n");
+        Out_Close();
+        Out_Text("\n");
+        Out_Close();
     }
-    printf("\n");
+    Out_Close();
+    Out_Text("\n");
     // Print sub info for each sub
-    for (i=0; i<M; i++) {
-        p=HT[i];
-        while (p!=NULL) { // For subs in chain
-            printf("    SUBSCRIBERID = %d, GROUPLIST =\n", p->sId);
-            for (j=0; j<MG; j++) { // Print sub's new Consumption tree of every interested group
-                if (p->tgp[j]!=(TreeInfo*) 1) {
-                    printf("        %d, TREELIST =", G[j].gId);
-                    Consumption_Print(p->tgp[j]);
-                    printf("\n");
-                }
-            }
-            printf("\n");
-            p=p->snext;
+    Out_Open("deliveries", '[');
+    for (p = Hash_First(&it); p != NULL; p = Hash_Next(&it)) {
+        Out_Open(NULL, '{');
+        Out_Text("    SUBSCRIBERID = ");
+        Out_Int("sid", p->sId);
+        Out_Text(", GROUPLIST =\n");
+        Out_Open("groups", '[');
+        for (j=0; j<p->sgn; j++) { // Print sub's deliveries of every interested group
+            Out_Open(NULL, '{');
+            Out_Text("        ");
+            Out_Int("gid", p->sgs[j].gId);
+            Out_Text(", TREELIST =");
+            Out_Open("infos", '[');
+            Consumption_Print(&E->G[p->sgs[j].gs], p->sgs[j].tgp);
+            Out_Close();
+            Out_Text("\n");
+            Out_Close();
         }
+        Out_Close();
+        Out_Text("\n");
+        Out_Close();
     }
+    Out_Close();
+    Out_End();
     return EXIT_SUCCESS;
 }
 
@@ -231,23 +532,159 @@ int Prune(int tm){
  */
 int Consume(int sId){
     int i;
-    TreeInfo* preConsume[MG];
-    SubInfo *sub = getSub(sId);
+    long preConsume;
+    Delivery d;
+    Merge *h;
+    SubInfo *sub;
+    Engine_Lock(0);
+    sub = getSub(sId);
     // Checks & fixes
-    if (!isSubValid(sId)) return EXIT_FAILURE;
-    // Keeps a copy of sgp array for the printing process later
-    for (i=0; i<MG; i++) preConsume[i]=sub->sgp[i];
-    // Consumes
-    for (i=0; i<MG; i++) {
-        if (sub->tgp[i]!=(TreeInfo*) 1) {
-            sub->sgp[i]=ConsumeInfo(sub->tgp[i], (sub->sgp[i]==NULL)?NULL:sub->sgp[i]->prev);
-        }
+    if (!isSubValid(sId)) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
     }
-    // Print
-    Consume_Print(sub, preConsume);
+    Out_Begin('C');
+    Out_Text("C ");
+    Out_Int("sid", sub->sId);
+    Out_Text(" DONE\n");
+    if (E->CONSUME_MERGE) {
+        // One stream for all groups, oldest first, every info once
+        Out_Text("    TREELIST =");
+        Out_Open("infos", '[');
+        h = Merge_Self();
+        Sub_LockGroups(sub);
+        Merge_Start(h, sub);
+        while (Merge_Next(h, sub, &d))
+            Out_Item(d.iId);
+        for (i=0; i<sub->sgn; i++)
+            Log_Reclaim(&E->G[sub->sgs[i].gs]);
+        Sub_UnlockGroups(sub);
+        // Nothing is pending, so the next delivery is told of
+        __atomic_store_n(&sub->sready, 0, __ATOMIC_RELAXED);
+        Out_Close();
+        Out_Text("\n");
+        Out_End();
+        Engine_Unlock();
+        return EXIT_SUCCESS;
+    }
+    Out_Open("groups", '[');
+    for (i=0; i<sub->sgn; i++) {
+        Group_Lock(&E->G[sub->sgs[i].gs]);
+        // Keeps a copy of sgp for the printing process
+        preConsume = sub->sgs[i].sgp;
+        // Consumes
+        ConsumeInfo(&sub->sgs[i]);
+        // Print
+        Consume_Print(&sub->sgs[i], preConsume);
+        // Log segments every sub has moved past can go now that they are printed
+        Log_Reclaim(&E->G[sub->sgs[i].gs]);
+        Group_Unlock(&E->G[sub->sgs[i].gs]);
+    }
+    __atomic_store_n(&sub->sready, 0, __ATOMIC_RELAXED);
+    Out_Close();
+    Out_End();
+    Engine_Unlock();
     return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Consume Information for subscriber without printing it
+ *
+ * @param sId Subscriber identifier
+ * @param cb Called with every run of newly consumed infos, group by group
+ * @param ctx Passed to cb
+ * @return 0 on success
+ *          1 on failure
+ */
+int Consume_Each(int sId, ConsumeCallback cb, void *ctx){
+    int i;
+    long from;
+    LogSegment *seg;
+    SubInfo *sub;
+    Engine_Lock(0);
+    sub = getSub(sId);
+    if (!isSubValid(sId)) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
+    for (i=0; i<sub->sgn; i++) {
+        Group_Lock(&E->G[sub->sgs[i].gs]);
+        // The old pin stays alive until the log is reclaimed below
+        from = SubGroup_Next(&sub->sgs[i]);
+        seg = sub->sgs[i].spin;
+        ConsumeInfo(&sub->sgs[i]);
+        Log_Runs(seg, from, E->G[sub->sgs[i].gs].gend, sub->sgs[i].gId, cb, ctx);
+        Log_Reclaim(&E->G[sub->sgs[i].gs]);
+        Group_Unlock(&E->G[sub->sgs[i].gs]);
+    }
+    __atomic_store_n(&sub->sready, 0, __ATOMIC_RELAXED);
+    Engine_Unlock();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Count the infos a subscriber has not consumed yet
+ *
+ * @param sId Subscriber identifier
+ * @param gId Group identifier (-1 for all of the subscriber's groups)
+ * @return Number of pending infos
+ *         -1 on failure
+ */
+long Consume_Pending(int sId, int gId){
+    int i;
+    long n=0;
+    SubInfo *sub;
+    Engine_Lock(0);
+    sub = getSub(sId);
+    if (!isSubValid(sId)) {
+        Engine_Unlock();
+        return -1;
+    }
+    for (i=0; i<sub->sgn; i++) {
+        if (gId==-1 || sub->sgs[i].gId==gId) {
+            Group_Lock(&E->G[sub->sgs[i].gs]);
+            n += E->G[sub->sgs[i].gs].gend - SubGroup_Next(&sub->sgs[i]);
+            Group_Unlock(&E->G[sub->sgs[i].gs]);
+        }
+    }
+    Engine_Unlock();
+    return n;
+}
+
+/**
+ * @brief Consume up to a number of infos into a caller's array
+ *
+ * @param sId Subscriber identifier
+ * @param max Capacity of out
+ * @param out Filled with the consumed infos
+ * @return Number of infos written to out
+ *         -1 on failure
+ */
+int Consume_Batch(int sId, int max, Delivery *out){
+    int i, n=0;
+    Merge *h;
+    SubInfo *sub;
+    if (max<0 || (max>0 && out==NULL)) return -1;
+    Engine_Lock(0);
+    sub = getSub(sId);
+    if (!isSubValid(sId)) {
+        Engine_Unlock();
+        return -1;
+    }
+    h = Merge_Self();
+    Sub_LockGroups(sub);
+    Merge_Start(h, sub);
+    while (n<max && Merge_Next(h, sub, &out[n]))
+        n++;
+    for (i=0; i<sub->sgn; i++)
+        Log_Reclaim(&E->G[sub->sgs[i].gs]);
+    Sub_UnlockGroups(sub);
+    // A full batch may have left infos pending
+    if (n<max) __atomic_store_n(&sub->sready, 0, __ATOMIC_RELAXED);
+    Engine_Unlock();
+    return n;
+}
+
 /**
  * @brief Delete subscriber
  *
@@ -256,26 +693,34 @@ int Consume(int sId){
  *          1 on failure
  */
 int Delete_Subscriber(int sId){
-    int i;
-    Info* gids_arr[MG];
+    int i, sgn;
+    SubGroup *sgs;
+    SubInfo* sub;
+    Engine_Lock(1);
     // Checks & fixes
-    SubInfo* sub = Hash_LookUp(sId);
-    if (sub==NULL) return EXIT_FAILURE;
+    sub = Hash_LookUp(sId);
+    if (sub==NULL) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
+    if (sub->swatch) Watch_Stop(sub);
+    // Keeps sub's interests for the printing process
+    sgs = sub->sgs;
+    sgn = sub->sgn;
+    sub->sgs = NULL;
     // Deletes sub from groups
-    for (i=0; i<MG; i++) {
-        // Keeps a copy of sub's interests for the printing process
-        if (sub->tgp[i]!= (TreeInfo*) 1)
-            gids_arr[i]=NULL;
-        else
-            gids_arr[i]= (Info*) 1;
-        // Deletes them from their interested groups
-        if (gids_arr[i]!= (Info*) 1)
-            G[i].gsub = Subscriber_Delete(G[i].gsub, sId);
+    for (i=0; i<sgn; i++) {
+        // Deletes them from their interested groups and releases their log position
+        E->G[sgs[i].gs].gsub = Subscriber_Delete(E->G[sgs[i].gs].gsub, sId);
+        sgs[i].spin->refs--;
+        Log_Reclaim(&E->G[sgs[i].gs]);
     }
     // Deletes sub from Hash Table
     Hash_Delete(sId);
     // Print
-    Delete_Subscriber_Print(sId, gids_arr);
+    Delete_Subscriber_Print(sId, sgs, sgn);
+    Mem_FreeSize(sgs, sgn*sizeof(SubGroup));
+    Engine_Unlock();
     return EXIT_SUCCESS;
 }
 /**
@@ -289,72 +734,102 @@ int Print_all(void){
     Info* info;
     Sub* sub;
     SubInfo* subinfo;
-    printf("P DONE\n");
-    for (i=0; i<MG; i++) {
+    HashIter it;
+    if (E->OUT.format==OUTPUT_NONE) return EXIT_SUCCESS;
+    Engine_Lock(1);
+    Out_Begin('P');
+    Out_Text("P DONE\n");
+    Out_Open("groups", '[');
+    for (i=0; i<E->GN; i++) {
         // Prints group
-        printf("    GROUPID = %d, INFOLIST=", G[i].gId);
-        info=G[i].gr;
+        Out_Open(NULL, '{');
+        Out_Text("    GROUPID = ");
+        Out_Int("gid", E->G[i].gId);
+        Out_Text(", INFOLIST=");
+        Out_Open("infos", '[');
+        info=E->G[i].gr;
         printGroupInfo(info);
-        printf(", SUBLIST =");
-        sub=G[i].gsub;
+        Out_Close();
+        Out_Text(", SUBLIST =");
+        Out_Open("subs", '[');
+        sub=E->G[i].gsub;
         while(sub!=NULL) {
-            printf(" %d", sub->sId);
+            Out_Item(sub->sId);
             sub=sub->snext;
         }
-        printf("\n");
+        Out_Close();
+        Out_Text("\n");
+        Out_Close();
     }
+    Out_Close();
     // Prints sublist
-    printf("    SUBSCRIBERLIST =");
-    for (i = 0; i<M; i++) {
-        subinfo = HT[i];
-        while (subinfo != NULL) {
-            printf(" %d", subinfo->sId);
-            subinfo = subinfo->snext;
-            subs++;
-        }
+    Out_Text("    SUBSCRIBERLIST =");
+    Out_Open("subscribers", '[');
+    for (subinfo = Hash_First(&it); subinfo != NULL; subinfo = Hash_Next(&it)) {
+        Out_Item(subinfo->sId);
+        subs++;
     }
-    printf("\n");
+    Out_Close();
+    Out_Text("\n");
     // Prints SubInfo list
-    for (i = 0; i<M; i++) {
-        subinfo = HT[i];
-        while (subinfo != NULL) {
-            printf("    SUBSCRIBERID = %d, GROUPLIST =\n", subinfo->sId);
-            for (j = 0; j < MG; j++) {
-                if (subinfo->tgp[j] != (TreeInfo *) 1) {
-                    printf("        %d, TREEINFO =", G[j].gId);
-                    Consumption_Print(subinfo->tgp[j]);
-                    printf("\n");
-                }
-            }
-            subinfo = subinfo->snext;
+    Out_Open("deliveries", '[');
+    for (subinfo = Hash_First(&it); subinfo != NULL; subinfo = Hash_Next(&it)) {
+        Out_Open(NULL, '{');
+        Out_Text("    SUBSCRIBERID = ");
+        Out_Int("sid", subinfo->sId);
+        Out_Text(", GROUPLIST =\n");
+        Out_Open("groups", '[');
+        for (j = 0; j < subinfo->sgn; j++) {
+            Out_Open(NULL, '{');
+            Out_Text("        ");
+            Out_Int("gid", subinfo->sgs[j].gId);
+            Out_Text(", TREEINFO =");
+            Out_Open("infos", '[');
+            Consumption_Print(&E->G[subinfo->sgs[j].gs], subinfo->sgs[j].tgp);
+            Out_Close();
+            Out_Text("\n");
+            Out_Close();
         }
+        Out_Close();
+        Out_Close();
     }
+    Out_Close();
     // Prints last line
-    printf("    NO_GROUPS = %d, NO_SUBSCRIBERS = %d\n", MG, subs);
+    Out_Text("    NO_GROUPS = ");
+    Out_Int("groups_count", E->GN);
+    Out_Text(", NO_SUBSCRIBERS = ");
+    Out_Int("subscribers_count", subs);
+    Out_Text("\n");
+    Out_End();
+    Engine_Unlock();
     return EXIT_SUCCESS;
 }
 
 // FUNCTIONS
 
 /**
- * Consumes info from the LO Tree
- * @param info LO Tree
- * @param end Last consumption point (including itself)
- * @return Newest info
+ * Consumes every info delivered to a sub for a group
+ * Only the cursor moves, so this takes constant time
+ * @param sg Sub's state for the group to consume from
+ */
+void ConsumeInfo(SubGroup *sg) {
+    Group *g = &E->G[sg->gs];
+    // Nothing was delivered since the sub registered
+    if (g->gend <= sg->tgp) return;
+    // Moves consumption point to the newest delivery
+    sg->sgp = g->gend-1;
+    Log_Repin(g, &sg->spin);
+}
+
+/**
+ * Returns the first offset of a group's log a sub has not consumed
+ * @param sg Sub's state for the group
+ * @return Offset (the group's log end if nothing is pending)
  */
-TreeInfo* ConsumeInfo(TreeInfo *info, TreeInfo *end) {
-    TreeInfo* p = info, *newest;
-    if (info==NULL) return NULL;
-    // Goes to newest
-    while (p->trc!=NULL)
-        p=p->trc;
-    // Saves it to return it
-    newest=p;
-    // "Consumes"
-    while (p!=end)
-        p=p->prev;
-    return newest;
+long SubGroup_Next(const SubGroup *sg) {
+    return (sg->sgp==-1) ? sg->tgp : sg->sgp+1;
 }
+
 /**
  * Returns the requested sub info
  * @param id Sub id
@@ -373,196 +848,245 @@ SubInfo *getSub(int id) {
 }
 
 /**
- * Deletes Info node from BST
- * @param T BS Tree
- * @param id Id to be removed
- * @return New Tree
+ * Returns the height of an AVL subtree
+ * @param T AVL Tree
+ * @return Height (0 for an empty tree)
  */
-Info* Info_Delete(Info* T, int id) {
-    Info* p, *tmp;
-    // Checks if it exists
-    p = Info_LookUp(T, id);
-    if (p!=NULL) {
-        if (p->ilc==NULL && p->irc==NULL) { // Is leaf
-            if (T==p) { // Is root
-                free(p);
-                return NULL;
-            }
-            if (p->iId<p->ip->iId) // Is left child
-                p->ip->ilc=NULL;
-            else
-                p->ip->irc=NULL; // Is right child
-            free(p);
-        } else if (p->ilc!=NULL && p->irc!=NULL) { // Has 2 children
-            tmp = p->irc;               // Gets Inorder successor
-            while (tmp->ilc!=NULL) {    // (One right and all left)
-                tmp=tmp->ilc;
-            }
-            p->iId=tmp->iId; // Moves it to p
-            if (tmp->irc != NULL) { // Gets successor's right children
-                tmp->irc->ip = tmp->ip;
-            }
-            if (p->irc==tmp) { // If successor is p's right child
-                tmp->ip->irc = tmp->irc;
-            } else { // If successor is p's left child
-                tmp->ip->ilc = tmp->irc;
-            }
-            free(tmp);
-        } else { // Has 1 child
-            if (p->ilc!=NULL) { // Has left child
-                p->ilc->ip=p->ip;
-                if (p->ip!=NULL && p->ip->iId>=p->iId) // Left child become father's left child
-                    p->ip->ilc=p->ilc;
-                else if (p->ip!=NULL && p->ip->iId<p->iId) // Right child become father's left child
-                    p->ip->irc=p->ilc;
-                else
-                    T=p->ilc; // Child becomes root
-            } else { // Has right child
-                p->irc->ip=p->ip;
-                if (p->ip!=NULL && p->ip->iId>=p->iId) // Right child become father's right child
-                    p->ip->ilc=p->irc;
-                else if (p->ip!=NULL && p->ip->iId<p->iId) // Left child become father's right child
-                    p->ip->irc=p->irc;
-                else
-                    T=p->irc; // Child becomes root
-            }
-            free(p);
-        }
+static int Info_Height(Info *T) {
+    return (T==NULL)?0:T->ih;
+}
+
+/**
+ * Recomputes the height of an AVL node from its children
+ * @param T AVL node
+ */
+static void Info_Update(Info *T) {
+    int l = Info_Height(T->ilc), r = Info_Height(T->irc);
+    T->ih = 1 + ((l>r)?l:r);
+}
+
+/**
+ * Rotates an AVL subtree to the left
+ * @param x Root of the subtree
+ * @return New root of the subtree (its parent link is left to the caller)
+ */
+static Info* Info_RotateLeft(Info *x) {
+    Info *y = x->irc;
+    x->irc = y->ilc;
+    if (y->ilc!=NULL) y->ilc->ip = x;
+    y->ip = x->ip;
+    y->ilc = x;
+    x->ip = y;
+    Info_Update(x);
+    Info_Update(y);
+    return y;
+}
+
+/**
+ * Rotates an AVL subtree to the right
+ * @param x Root of the subtree
+ * @return New root of the subtree (its parent link is left to the caller)
+ */
+static Info* Info_RotateRight(Info *x) {
+    Info *y = x->ilc;
+    x->ilc = y->irc;
+    if (y->irc!=NULL) y->irc->ip = x;
+    y->ip = x->ip;
+    y->irc = x;
+    x->ip = y;
+    Info_Update(x);
+    Info_Update(y);
+    return y;
+}
+
+/**
+ * Restores the AVL property of a node whose subtrees differ by at most 2
+ * @param T AVL node
+ * @return New root of the subtree
+ */
+static Info* Info_Rebalance(Info *T) {
+    int bf;
+    Info_Update(T);
+    bf = Info_Height(T->ilc) - Info_Height(T->irc);
+    if (bf > 1) { // Left heavy
+        if (Info_Height(T->ilc->ilc) < Info_Height(T->ilc->irc))
+            T->ilc = Info_RotateLeft(T->ilc);
+        return Info_RotateRight(T);
+    }
+    if (bf < -1) { // Right heavy
+        if (Info_Height(T->irc->irc) < Info_Height(T->irc->ilc))
+            T->irc = Info_RotateRight(T->irc);
+        return Info_RotateLeft(T);
     }
     return T;
 }
 
 /**
- * Inserts Info in sub's consumption tree
- * @param T LO Tree
- * @param id Info id
- * @param tm Info tm
- * @param sub Owner of the tree
- * @param k Group (This tree belongs to group k)
- * @return New LO Tree
- */
-TreeInfo* Consumption_Insert(TreeInfo* T, int id, int tm, SubInfo* sub, int k) {
-    TreeInfo *new, *p, *newrc, *newlc;
-    if (T==NULL) { // Tree is empty
-        new = (TreeInfo*) malloc(sizeof(TreeInfo));
-        new->tlc=NULL; new->trc=NULL;
-        new->tp=NULL;
-        new->next=NULL; new->prev=NULL;
-        new->tId=id;
-        new->ttm=tm;
-        return new;
-    }
-    p=T;
-    while(p->tlc!=NULL) { // Find where to place it (like BST Search)
-        if (p->ttm<tm)
-            p=p->trc;
+ * Rebalances every node from p up to the root of the tree
+ * @param T AVL Tree
+ * @param p Lowest node whose subtree changed
+ * @return New AVL Tree
+ */
+static Info* Info_Retrace(Info *T, Info *p) {
+    Info *par, *sub;
+    bool left;
+    while (p!=NULL) {
+        par = p->ip;
+        left = (par!=NULL && par->ilc==p);
+        sub = Info_Rebalance(p);
+        if (par==NULL)
+            T = sub; // Reached the root
+        else if (left)
+            par->ilc = sub;
         else
-            p=p->tlc;
-    }
-    // Create new children
-    newlc = (TreeInfo*) malloc(sizeof(TreeInfo));
-    newlc->tlc=NULL; newlc->trc=NULL;
-    newrc = (TreeInfo*) malloc(sizeof(TreeInfo));
-    newrc->tlc=NULL; newrc->trc=NULL;
-    p->trc=newrc;
-    p->tlc=newlc;
-    // Has to be placed as right child
-    if (p->ttm<tm) {
-        // RC=new node
-        newrc->tp = p;
-        newrc->tId = id;
-        newrc->ttm = tm;
-        newrc->next = p->next;
-        if (p->next != NULL) p->next->prev = newrc;
-        newrc->prev = newlc;
-        // LC=father
-        newlc->tp = p;
-        newlc->tId = p->tId;
-        newlc->ttm = p->ttm;
-        newlc->next = newrc;
-        newlc->prev = p->prev;
-        if (p->prev != NULL) p->prev->next = newlc;
-        // Fix sgp's pointer (consumption pointer)
-        if (sub->sgp[k]==p) {
-            sub->sgp[k]=newlc;
-        }
-    } else {
-        // LC = new node
-        newlc->tp=p;
-        newlc->tId=id;
-        newlc->ttm=tm;
-        newlc->next=newrc;
-        newlc->prev=p->prev;
-        if (p->prev!=NULL) p->prev->next=newlc;
-        // RC = father
-        newrc->tp=p;
-        newrc->tId=p->tId;
-        newrc->ttm=p->ttm;
-        newrc->next=p->next;
-        if (p->next!=NULL) p->next->prev=newrc;
-        newrc->prev=newlc;
-        // Father=LC
-        p->tId=id;
-        p->ttm=tm;
-        // Fix sgp's pointer (consumption pointer)
-        if (sub->sgp[k]==p) {
-            sub->sgp[k]=newrc;
-        }
+            par->irc = sub;
+        p = par;
     }
-    // Remove father's list connections
-    p->next=NULL;
-    p->prev=NULL;
     return T;
 }
 
 /**
- * Search a BS Tree
- * @param T BS Tree
+ * Deletes Info node from AVL Tree
+ * @param T AVL Tree
+ * @param id Id to be removed
+ * @return New Tree
+ */
+Info* Info_Delete(Info* T, int id) {
+    Info *p, *tmp, *child, *par;
+    GroupSet *igp;
+    // Checks if it exists
+    p = Info_LookUp(T, id);
+    if (p==NULL) return T;
+    if (p->ilc!=NULL && p->irc!=NULL) { // Has 2 children
+        tmp = p->irc;               // Gets Inorder successor
+        while (tmp->ilc!=NULL) {    // (One right and all left)
+            tmp=tmp->ilc;
+        }
+        // Moves it to p and deletes the successor instead
+        // (p's group list goes away with the successor's node)
+        igp=p->igp;
+        p->iId=tmp->iId;
+        p->itm=tmp->itm;
+        p->igp=tmp->igp;
+        tmp->igp=igp;
+        p=tmp;
+    }
+    // p has at most one child now
+    child = (p->ilc!=NULL)?p->ilc:p->irc;
+    par = p->ip;
+    if (child!=NULL) child->ip=par;
+    if (par==NULL)
+        T=child; // Child becomes root
+    else if (par->ilc==p)
+        par->ilc=child;
+    else
+        par->irc=child;
+    GroupSet_Release(p->igp);
+    Mem_Free(&E->PS.info, p);
+    return Info_Retrace(T, par);
+}
+
+/**
+ * Search an AVL Tree
+ * @param T AVL Tree
  * @param id Id to search
  * @return Pointer of id if found
  */
 Info* Info_LookUp(Info* T, int id) {
-    if (T==NULL)
-        return NULL;
-    if (T->iId==id)
-        return T;
-    else if (T->iId>id)
-        return Info_LookUp(T->ilc, id);
-    else
-        return Info_LookUp(T->irc, id);
+    while (T!=NULL && T->iId!=id)
+        T = (T->iId>id) ? T->ilc : T->irc;
+    return T;
+}
+
+/**
+ * Makes room for one more element of a prune result array
+ * @param arr Array
+ * @param n Number of elements in it
+ * @param cap Its capacity
+ * @param size Size of an element
+ */
+static void Prune_Reserve(void **arr, int n, int *cap, size_t size) {
+    if (n < *cap) return;
+    *cap = (*cap == 0) ? 64 : 2 * *cap;
+    *arr = realloc(*arr, *cap * size);
 }
 
 /**
- * Prunes the given tree node (Whole tree for recursion)
- * @param T BS Tree to be pruned
+ * Prunes the given group (Expired infos are forwarded to group's subs)
+ * Only the expired prefix of the group's time index is visited
  * @param tm TM of pruning
- * @param k Group the tree belongs to
+ * @param k Group to be pruned
+ * @param res Records what moved (NULL to not record it)
  */
-void pruneTree(Info *T, int tm, int k) {
-    Sub* sub = NULL;
-    SubInfo *si = NULL;
-    // Tree is empty
-    if (T==NULL)
-        return;
-    else {
-        // Prune post-orderly
-        pruneTree(T->ilc, tm, k);
-        pruneTree(T->irc, tm, k);
-        // Prune condition
-        if (T->itm <= tm) {
-            // Get tree's sublist
-            sub = G[k].gsub;
-            // Add pruned info to every sub in the list
-            while (sub != NULL) {
-                si = getSub(sub->sId);
-                si->tgp[k] = Consumption_Insert(si->tgp[k], T->iId, T->itm, si, k);
-                sub = sub->snext;
+void pruneTree(int tm, int k, PruneResult *res) {
+    TimeEntry e;
+    PruneGroup *pg = NULL;
+    PruneMove *mv;
+    Sub *s;
+    while (E->G[k].gheapsize > 0 && E->G[k].gheap[0].tm <= tm) {
+        e = Heap_Pop(&E->G[k]);
+        if (res != NULL) {
+            if (pg == NULL) {
+                // First expired info of the group: Records its subs once
+                Prune_Reserve((void**) &res->groups, res->ngroups, &res->capgroups, sizeof(PruneGroup));
+                pg = &res->groups[res->ngroups++];
+                pg->gId = E->G[k].gId;
+                pg->moves = res->nmoves;
+                pg->nmoves = 0;
+                pg->subs = res->nsubs;
+                pg->nsubs = 0;
+                for (s = E->G[k].gsub; s != NULL; s = s->snext) {
+                    Prune_Reserve((void**) &res->subs, res->nsubs, &res->capsubs, sizeof(int));
+                    res->subs[res->nsubs++] = s->sId;
+                    pg->nsubs++;
+                }
             }
-            // After adding the pruned node to sub's consumption tree,
-            // delete it from the group's tree
-            G[k].gr = Info_Delete(G[k].gr, T->iId);
+            Prune_Reserve((void**) &res->moves, res->nmoves, &res->capmoves, sizeof(PruneMove));
+            mv = &res->moves[res->nmoves++];
+            mv->iId = e.id;
+            mv->itm = e.tm;
+            mv->off = (E->G[k].gsub != NULL) ? E->G[k].gend : -1;
+            pg->nmoves++;
+        }
+        // Delivers it once to the group's log, shared by all of its subs.
+        // Delivered ids stay in the index until their log segment is
+        // reclaimed, undelivered ones are forgotten
+        if (E->G[k].gsub != NULL) {
+            Log_Append(&E->G[k], e.id, e.tm);
+            // Only the group's own worker writes it
+            if (E->G[k].gwatch > 0) E->G[k].gnew = 1;
+        } else {
+            Index_Lock();
+            Index_Release(e.id);
+            Index_Unlock();
         }
+        // After delivering the pruned info, delete it from the group's tree
+        E->G[k].gr = Info_Delete(E->G[k].gr, e.id);
+    }
+    if (pg != NULL) pg->gend = E->G[k].gend;
+}
+
+/**
+ * Prunes every group
+ * @param tm Prune tm
+ * @param res Result to record the changes to (NULL to record nothing)
+ */
+void Prune_Groups(int tm, PruneResult *res) {
+    int i, due = 0;
+    if (res != NULL) {
+        res->ngroups = 0;
+        res->nmoves = 0;
+        res->nsubs = 0;
     }
+    // Waking the workers only pays off when several groups have expired infos
+    for (i = 0; i < E->GN && due < 2; i++)
+        if (E->G[i].gheapsize > 0 && E->G[i].gheap[0].tm <= tm) due++;
+    if (E->PW.n > 1 && due > 1) {
+        Prune_Parallel(tm, res);
+        return;
+    }
+    for (i = 0; i < E->GN; i++)
+        pruneTree(tm, i, res);
 }
 
 /**
@@ -594,16 +1118,25 @@ SubInfo *SubInfo_Delete(SubInfo* List, int id) {
         if (tmp==List) {
             del = List;
             List = List->snext;
-            free(del);
+            SubInfo_Free(del);
         } else {
             del = tmp;
             prev->snext=tmp->snext;
-            free(del);
+            SubInfo_Free(del);
         }
     }
     return List;
 }
 
+/**
+ * Frees a sub info node and its group states
+ * @param p Sub info
+ */
+void SubInfo_Free(SubInfo *p) {
+    Mem_FreeSize(p->sgs, p->sgn*sizeof(SubGroup));
+    Mem_Free(&E->PS.subinfo, p);
+}
+
 /**
  * Searches for the given sub
  * @param List Chain to be searched
@@ -619,14 +1152,38 @@ SubInfo* SubInfo_LookUp(SubInfo* List, int id) {
     else return NULL;
 }
 
+#ifndef OPEN_ADDRESSING
+/**
+ * Initializes the Hash Table
+ * @param m Number of chains
+ */
+void Hash_Init(int m) {
+    E->HT[0].ht = (SubInfo**) calloc(m, sizeof(SubInfo*));
+    E->HT[0].m = m;
+    E->HT[0].used = 0;
+    E->HT[0].a = E->A;
+    E->HT[0].b = E->B;
+    E->HT[0].p = E->P;
+    E->HT[1].ht = NULL;
+    E->rehashIdx = -1;
+}
+
 /**
  * Deletes a sub id from the Hash Table
  * @param id Id to be removed
  */
 void Hash_Delete(int id) {
+    HashTable *t = &E->HT[0];
     int p;
-    p = Universal_Hash_Function(id);
-    HT[p] = SubInfo_Delete(HT[p], id);
+    Hash_RehashStep(1);
+    p = Universal_Hash_Function(t, id);
+    if (SubInfo_LookUp(t->ht[p], id)==NULL && E->rehashIdx!=-1) { // Already moved
+        t = &E->HT[1];
+        p = Universal_Hash_Function(t, id);
+    }
+    if (SubInfo_LookUp(t->ht[p], id)==NULL) return;
+    t->ht[p] = SubInfo_Delete(t->ht[p], id);
+    t->used--;
 }
 
 /**
@@ -635,14 +1192,138 @@ void Hash_Delete(int id) {
  * @return SubInfo pointer of sub if it exists
  */
 SubInfo* Hash_LookUp(int id) {
-    SubInfo *p, *list;
-    int index;
-    index = Universal_Hash_Function(id);
-    list = HT[index];
-    p = SubInfo_LookUp(list, id);
+    SubInfo *p;
+    p = SubInfo_LookUp(E->HT[0].ht[Universal_Hash_Function(&E->HT[0], id)], id);
+    // While rehashing, the sub may have moved to the new table
+    if (p==NULL && E->rehashIdx!=-1)
+        p = SubInfo_LookUp(E->HT[1].ht[Universal_Hash_Function(&E->HT[1], id)], id);
     return p;
 }
 
+/**
+ * Links an existing SubInfo node in a sorted chain
+ * @param List Chain
+ * @param new Node to be linked
+ * @return New chain
+ */
+static SubInfo *SubInfo_Link(SubInfo *List, SubInfo *new) {
+    SubInfo *tmp=List, *prev=NULL;
+    while (tmp!=NULL && tmp->sId<new->sId) {
+        prev=tmp;
+        tmp=tmp->snext;
+    }
+    new->snext=tmp;
+    if (prev==NULL) return new;
+    prev->snext=new;
+    return List;
+}
+
+/**
+ * Returns the smallest prime greater or equal to n
+ * @param n Lower bound
+ * @return Prime number
+ */
+static int Next_Prime(int n) {
+    int d;
+    if (n<=2) return 2;
+    if (n%2==0) n++;
+    for (;; n+=2) {
+        for (d=3; d*d<=n && n%d!=0; d+=2);
+        if (d*d>n) return n;
+    }
+}
+
+/**
+ * Starts an incremental rehash to a table twice as large
+ * The new table draws its own universal hash function
+ */
+static void Hash_Expand(void) {
+    HashTable *t = &E->HT[1];
+    t->m = E->HT[0].m*2;
+    t->ht = (SubInfo**) calloc(t->m, sizeof(SubInfo*));
+    t->used = 0;
+    // p must cover every bucket of the new table
+    t->p = (E->HT[0].p >= t->m)?E->HT[0].p:Next_Prime(t->m);
+    t->a = random(1, t->p-1);
+    t->b = random(0, t->p-1);
+    E->rehashIdx = 0;
+}
+
+/**
+ * Moves a few chains from the old table to the new one
+ * @param n Number of non-empty chains to move
+ */
+void Hash_RehashStep(int n) {
+    SubInfo *p, *next;
+    int visits = n*10; // Bounds the work spent on empty buckets
+    if (E->rehashIdx==-1) return;
+    while (n>0 && visits-->0 && E->rehashIdx<E->HT[0].m) {
+        p = E->HT[0].ht[E->rehashIdx];
+        E->HT[0].ht[E->rehashIdx++] = NULL;
+        if (p==NULL) continue;
+        while (p!=NULL) {
+            next = p->snext;
+            E->HT[1].ht[Universal_Hash_Function(&E->HT[1], p->sId)] =
+                    SubInfo_Link(E->HT[1].ht[Universal_Hash_Function(&E->HT[1], p->sId)], p);
+            E->HT[0].used--;
+            E->HT[1].used++;
+            p = next;
+        }
+        n--;
+    }
+    // Old table is empty: the new one takes its place
+    if (E->rehashIdx==E->HT[0].m) {
+        free(E->HT[0].ht);
+        E->HT[0] = E->HT[1];
+        E->HT[1].ht = NULL;
+        E->rehashIdx = -1;
+    }
+}
+
+/**
+ * Starts iterating over every sub of the Hash Table
+ * @param it Iterator
+ * @return First sub or NULL if there is none
+ */
+SubInfo *Hash_First(HashIter *it) {
+    it->t = 0;
+    it->i = -1;
+    it->p = NULL;
+    return Hash_Next(it);
+}
+
+/**
+ * Moves an iterator to the next sub of the Hash Table
+ * The current sub may be freed once this returns
+ * @param it Iterator
+ * @return Next sub or NULL if there is none
+ */
+SubInfo *Hash_Next(HashIter *it) {
+    if (it->p!=NULL && it->p->snext!=NULL)
+        return it->p = it->p->snext;
+    while (it->t<2 && E->HT[it->t].ht!=NULL) {
+        while (++it->i < E->HT[it->t].m) {
+            if (E->HT[it->t].ht[it->i]!=NULL)
+                return it->p = E->HT[it->t].ht[it->i];
+        }
+        it->t++;
+        it->i = -1;
+    }
+    return it->p = NULL;
+}
+
+/**
+ * Frees the Hash Table (its subs must be freed already)
+ */
+void Hash_Free(void) {
+    free(E->HT[0].ht);
+    free(E->HT[1].ht);
+    E->HT[0].ht = NULL;
+    E->HT[1].ht = NULL;
+    E->rehashIdx = -1;
+}
+#endif /* OPEN_ADDRESSING */
+
 /**
  * Removes subscriber from a sub list
  * @param List Sub list
@@ -661,28 +1342,38 @@ Sub *Subscriber_Delete(Sub *List, int id) {
         if (tmp==List) {
             del = List;
             List = List->snext;
-            free(del);
+            Mem_Free(&E->PS.sub, del);
         } else {
             del = tmp;
             prev->snext=tmp->snext;
-            free(del);
+            Mem_Free(&E->PS.sub, del);
         }
     }
     return List;
 }
 
+#ifndef OPEN_ADDRESSING
 /**
  * Inserts a subscriber in the Hash Table
+ * The table doubles once it holds as many subs as buckets
  * @param sTM Sub's tm
  * @param sId Sub's id
  * @param gids_arr Groups he's interested to
  * @param size_of_gids_arr Size of gids_arr
  */
 void Hash_Insert(int sTM, int sId, int *gids_arr, int size_of_gids_arr) {
+    HashTable *t;
     int index;
-    index = Universal_Hash_Function(sId);
-    HT[index] = SubInfo_Insert(HT[index], sTM, sId, gids_arr, size_of_gids_arr);
+    Hash_RehashStep(1);
+    if (E->rehashIdx==-1 && E->HT[0].used>=E->HT[0].m)
+        Hash_Expand();
+    // New subs go straight to the new table while rehashing
+    t = (E->rehashIdx==-1)?&E->HT[0]:&E->HT[1];
+    index = Universal_Hash_Function(t, sId);
+    t->ht[index] = SubInfo_Insert(t->ht[index], sTM, sId, gids_arr, size_of_gids_arr);
+    t->used++;
 }
+#endif /* OPEN_ADDRESSING */
 
 /**
  * Inserts subscriber to a sub list
@@ -693,7 +1384,7 @@ void Hash_Insert(int sTM, int sId, int *gids_arr, int size_of_gids_arr) {
 Sub* Subscriber_Insert(struct Subscription *List, int id) {
     Sub *new, *tmp=List, *prev=NULL;
     // Creates new node
-    new = (Sub *) malloc(sizeof(Sub));
+    new = (Sub *) Mem_Alloc(&E->PS.sub);
     new->sId=id;
     // Sorts (finds where to insert it)
     while (tmp!=NULL && tmp->sId<id) {
@@ -727,26 +1418,41 @@ bool Subscriber_isUnique_sId(int id) {
  * @param List Chain to be inserted into
  * @param tm Sub's tm
  * @param id Sub's id
- * @param gids_arr Groups he's interested to
+ * @param gids_arr Slots of the groups he's interested to (-2 if invalid)
  * @param size_of_gids_arr Size of gids_arr
  * @return New SubInfo chain
  */
 SubInfo *SubInfo_Insert(SubInfo *List, int tm, int id, int *gids_arr, int size_of_gids_arr) {
     SubInfo *new, *tmp=List, *prev=NULL;
-    int i;
+    SubGroup sg;
+    int i, j, n=0;
     // Creates new node
-    new = (SubInfo *) malloc(sizeof(SubInfo));
+    new = (SubInfo *) Mem_Alloc(&E->PS.subinfo);
     new->sId=id;
     new->stm=tm;
-    for (i=0; i<MG; i++) {
-        if (SubInfo_Interested(gids_arr, size_of_gids_arr, i)) {
-            new->sgp[i]=NULL;
-            new->tgp[i]=NULL;
-        }
-        else {
-            new->sgp[i]= (struct TreeInfo *) 1;
-            new->tgp[i]= (struct TreeInfo *) 1;
-        }
+    new->swatch=0;
+    new->sready=0;
+    new->squeued=0;
+    new->snotify=NULL;
+    new->sctx=NULL;
+    // Keeps state only for the groups he's interested to, sorted by gid
+    for (i=0; i<size_of_gids_arr; i++)
+        if (gids_arr[i]!=-2) n++;
+    new->sgn=0;
+    new->sgs=(SubGroup *) Mem_AllocSize(n*sizeof(SubGroup));
+    for (i=0; i<size_of_gids_arr; i++) {
+        if (gids_arr[i]==-2) continue;
+        // Sub sees deliveries from the current end of the group's log
+        sg.gs=gids_arr[i];
+        sg.gId=E->G[sg.gs].gId;
+        sg.tgp=E->G[sg.gs].gend;
+        sg.sgp=-1;
+        sg.spin=E->G[sg.gs].gtail;
+        sg.spin->refs++;
+        sg.widx=-1;
+        for (j=new->sgn++; j>0 && new->sgs[j-1].gId>sg.gId; j--)
+            new->sgs[j]=new->sgs[j-1];
+        new->sgs[j]=sg;
     }
     // Sorts (finds where to insert it)
     while (tmp!=NULL && tmp->sId<id) {
@@ -765,32 +1471,32 @@ SubInfo *SubInfo_Insert(SubInfo *List, int tm, int id, int *gids_arr, int size_o
 }
 
 /**
- * Checks if k is contained in gids_arr
- * @param gids_arr Groups array
- * @param size_of_gids_arr size of gids_arr
- * @param k Group to be checked if it's contained
- * @return True if it contained
+ * Checks if an info was published to any group a sub is interested to
+ * @param sub Sub
+ * @param info Info
+ * @return True if they share a group
  */
-bool SubInfo_Interested(const int* gids_arr, int size_of_gids_arr, int k) {
-    int i;
-    for (i=0; i<size_of_gids_arr; i++) {
-        if (gids_arr[i]==k) return true;
+bool SubInfo_Matches(SubInfo *sub, Info *info) {
+    int i = 0, j = 0;
+    // Both lists are sorted by gid
+    while (i < sub->sgn && j < info->igp->n) {
+        if (sub->sgs[i].gId == info->igp->gids[j]) return true;
+        if (sub->sgs[i].gId < info->igp->gids[j]) i++;
+        else j++;
     }
     return false;
 }
 
 /**
- * Insert Info in BS Tree
- * @param T BS Tree
+ * Insert Info in AVL Tree
+ * @param T AVL Tree
  * @param tm Info tm
  * @param id Info id
- * @param gids_arr Groups the info is associated with
- * @param size_of_gids_arr Size of gids_arr
- * @return New Info BS Tree
+ * @param igp Groups the info is associated with (shared by its copies)
+ * @return New Info AVL Tree
  */
-Info* Info_Insert(Info* T, int tm, int id, int* gids_arr, int size_of_gids_arr) {
+Info* Info_Insert(Info* T, int tm, int id, GroupSet *igp) {
     Info* p = T, *par = NULL, *new;
-    int i;
     // Find where to insert it (Like BST Search)
     while(p!=NULL) {
         par=p;
@@ -801,25 +1507,24 @@ Info* Info_Insert(Info* T, int tm, int id, int* gids_arr, int size_of_gids_arr)
         }
     }
     // Create new node
-    new = (Info *) malloc(sizeof(Info));
+    new = (Info *) Mem_Alloc(&E->PS.info);
     new->iId=id;
     new->itm=tm;
-    for(i=0; i<MG; i++) {
-        if (SubInfo_Interested(gids_arr, size_of_gids_arr, i)) new->igp[i]= 1;
-        else new->igp[i]=0;
-    }
+    new->igp=igp;
+    igp->refs++;
     // Insert it in tree
+    new->ih=1;
     new->ilc=NULL;
     new->irc=NULL;
     new->ip=par;
-    if (par!=NULL && par->iId>=id) // Placed as left child
+    if (par==NULL)
+        return new; // Is root
+    if (par->iId>=id) // Placed as left child
         par->ilc=new;
-    else if (par!=NULL && par->iId<id) // Placed as right child
+    else // Placed as right child
         par->irc=new;
-    else {
-        return new; // Is root
-    }
-    return T;
+    // Restore balance on the way up
+    return Info_Retrace(T, par);
 }
 
 /**
@@ -827,257 +1532,2247 @@ Info* Info_Insert(Info* T, int tm, int id, int* gids_arr, int size_of_gids_arr)
  * @param id Id to be checked
  * @return True if it is unique
  */
-bool Info_isUnique_iId(int id, int tm) {
-    int i, j;
-    Info *p;
-    SubInfo *si;
-    TreeInfo *ti;
-    // Checks the info list of every group
-    for (i = 0; i < MG; i++) {
-        p = G[i].gr;
-        p = Info_LookUp(p, id);
-        if (p!=NULL) return false;
-    }
-    // Checks the consumption tree of every sub
-    for (i = 0; i<M; i++) {
-        si = HT[i];
-        while (si!=NULL) {
-            for (j = 0; j<MG; j++) {
-                ti = si->tgp[i];
-                if (ti!=(TreeInfo*) 1 && Consumption_LookUp(ti, tm, id)!=NULL) {
-                    return false;
-                }
-            }
-            si = si->snext;
-        }
+bool Info_isUnique_iId(int id) {
+    return !Index_Contains(id);
+}
+
+#ifdef OPEN_ADDRESSING
+// OPEN ADDRESSING DIRECTORY
+
+/**
+ * Returns the home slot of a sub id (Robin Hood table)
+ * @param id Sub id
+ * @param m Capacity of the table (power of 2)
+ * @return Slot index
+ */
+static int Hash_Slot(int id, int m) {
+    unsigned int h = (unsigned int) id * 2654435769u;
+    return (int) ((h ^ (h>>16)) & (unsigned int) (m-1));
+}
+
+/**
+ * Allocates an empty table
+ * @param t Table
+ * @param m Capacity (power of 2)
+ */
+static void Hash_Alloc(HashTable *t, int m) {
+    t->keys = (int*) malloc(m*sizeof(int));
+    t->dist = (unsigned char*) calloc(m, sizeof(unsigned char));
+    t->subs = (SubInfo**) malloc(m*sizeof(SubInfo*));
+    t->m = m;
+    t->used = 0;
+}
+
+/**
+ * Initializes the Hash Table
+ * Keys and probe distances live apart from the (large) SubInfo nodes,
+ * so probing only touches the dense key arrays
+ * @param m Initial capacity, rounded up to a power of 2
+ */
+void Hash_Init(int m) {
+    int c = 16;
+    while (c < m) c<<=1;
+    Hash_Alloc(&E->HT[0], c);
+}
+
+static void Hash_Grow(void);
+
+/**
+ * Places a sub in the table, displacing richer entries (Robin Hood)
+ * @param id Sub id
+ * @param sub Sub info
+ */
+static void Hash_Place(int id, SubInfo *sub) {
+    HashTable *t = &E->HT[0];
+    int i = Hash_Slot(id, t->m), d = 1, tk, td;
+    SubInfo *ts;
+    while (t->dist[i] != 0) {
+        if (t->dist[i] < d) { // Takes the slot of an entry closer to its home
+            tk = t->keys[i]; ts = t->subs[i]; td = t->dist[i];
+            t->keys[i] = id; t->subs[i] = sub; t->dist[i] = (unsigned char) d;
+            id = tk; sub = ts; d = td;
+        }
+        i = (i+1) & (t->m-1);
+        if (++d == 255) { // Probe distance no longer fits: grow and retry
+            Hash_Grow();
+            Hash_Place(id, sub);
+            return;
+        }
+    }
+    t->keys[i] = id;
+    t->subs[i] = sub;
+    t->dist[i] = (unsigned char) d;
+    t->used++;
+}
+
+/**
+ * Doubles the capacity of the table
+ */
+static void Hash_Grow(void) {
+    HashTable old = E->HT[0];
+    int i;
+    Hash_Alloc(&E->HT[0], old.m*2);
+    for (i=0; i<old.m; i++) {
+        if (old.dist[i] != 0) Hash_Place(old.keys[i], old.subs[i]);
+    }
+    free(old.keys);
+    free(old.dist);
+    free(old.subs);
+}
+
+/**
+ * Finds the slot of a sub id
+ * @param id Sub id
+ * @return Slot index or -1 if not found
+ */
+static int Hash_Find(int id) {
+    HashTable *t = &E->HT[0];
+    int i = Hash_Slot(id, t->m), d = 1;
+    // Stops as soon as entries are closer to their home than we are
+    while (t->dist[i] >= d) {
+        if (t->keys[i] == id) return i;
+        i = (i+1) & (t->m-1);
+        d++;
+    }
+    return -1;
+}
+
+/**
+ * Inserts a subscriber in the Hash Table
+ * @param sTM Sub's tm
+ * @param sId Sub's id
+ * @param gids_arr Groups he's interested to
+ * @param size_of_gids_arr Size of gids_arr
+ */
+void Hash_Insert(int sTM, int sId, int *gids_arr, int size_of_gids_arr) {
+    if ((E->HT[0].used+1)*5 > E->HT[0].m*4) Hash_Grow(); // Keeps load factor under 0.8
+    Hash_Place(sId, SubInfo_Insert(NULL, sTM, sId, gids_arr, size_of_gids_arr));
+}
+
+/**
+ * Searches for a sub in the Hash Table
+ * @param id Id of the sub
+ * @return SubInfo pointer of sub if it exists
+ */
+SubInfo* Hash_LookUp(int id) {
+    int i = Hash_Find(id);
+    return (i == -1)?NULL:E->HT[0].subs[i];
+}
+
+/**
+ * Deletes a sub id from the Hash Table
+ * @param id Id to be removed
+ */
+void Hash_Delete(int id) {
+    HashTable *t = &E->HT[0];
+    int i = Hash_Find(id), j;
+    if (i == -1) return;
+    SubInfo_Free(t->subs[i]);
+    // Backward shift deletion
+    j = (i+1) & (t->m-1);
+    while (t->dist[j] > 1) {
+        t->keys[i] = t->keys[j];
+        t->subs[i] = t->subs[j];
+        t->dist[i] = (unsigned char) (t->dist[j]-1);
+        i = j;
+        j = (j+1) & (t->m-1);
+    }
+    t->dist[i] = 0;
+    t->used--;
+}
+
+/**
+ * Starts iterating over every sub of the Hash Table
+ * @param it Iterator
+ * @return First sub or NULL if there is none
+ */
+SubInfo *Hash_First(HashIter *it) {
+    it->i = -1;
+    return Hash_Next(it);
+}
+
+/**
+ * Moves an iterator to the next sub of the Hash Table
+ * The current sub may be freed once this returns
+ * @param it Iterator
+ * @return Next sub or NULL if there is none
+ */
+SubInfo *Hash_Next(HashIter *it) {
+    while (++it->i < E->HT[0].m) {
+        if (E->HT[0].dist[it->i] != 0)
+            return it->p = E->HT[0].subs[it->i];
+    }
+    return it->p = NULL;
+}
+
+/**
+ * Frees the Hash Table (its subs must be freed already)
+ */
+void Hash_Free(void) {
+    free(E->HT[0].keys);
+    free(E->HT[0].dist);
+    free(E->HT[0].subs);
+    E->HT[0].keys = NULL;
+    E->HT[0].dist = NULL;
+    E->HT[0].subs = NULL;
+    E->HT[0].m = 0;
+    E->HT[0].used = 0;
+}
+#endif /* OPEN_ADDRESSING */
+
+// TIME INDEX
+
+/**
+ * Checks if time entry a expires before time entry b
+ * @param a Time entry
+ * @param b Time entry
+ * @return True if a comes first
+ */
+static bool Heap_Less(TimeEntry a, TimeEntry b) {
+    return a.tm < b.tm || (a.tm == b.tm && a.id < b.id);
+}
+
+/**
+ * Adds an info to a group's time index (binary min-heap on tm)
+ * @param g Group
+ * @param tm Info tm
+ * @param id Info id
+ */
+void Heap_Push(Group *g, int tm, int id) {
+    int i, parent;
+    TimeEntry e;
+    if (g->gheapsize == g->gheapcap) {
+        g->gheapcap = (g->gheapcap==0)?16:g->gheapcap*2;
+        g->gheap = (TimeEntry*) realloc(g->gheap, g->gheapcap*sizeof(TimeEntry));
+    }
+    e.tm = tm;
+    e.id = id;
+    // Sift up
+    i = g->gheapsize++;
+    while (i > 0) {
+        parent = (i-1)/2;
+        if (!Heap_Less(e, g->gheap[parent])) break;
+        g->gheap[i] = g->gheap[parent];
+        i = parent;
+    }
+    g->gheap[i] = e;
+}
+
+/**
+ * Removes the oldest info from a group's time index
+ * @param g Group (its time index must not be empty)
+ * @return Oldest time entry
+ */
+TimeEntry Heap_Pop(Group *g) {
+    int i = 0, child, n;
+    TimeEntry top = g->gheap[0], last;
+    n = --g->gheapsize;
+    last = g->gheap[n];
+    // Sift down
+    while ((child = 2*i+1) < n) {
+        if (child+1 < n && Heap_Less(g->gheap[child+1], g->gheap[child])) child++;
+        if (!Heap_Less(g->gheap[child], last)) break;
+        g->gheap[i] = g->gheap[child];
+        i = child;
+    }
+    g->gheap[i] = last;
+    return top;
+}
+
+// DELIVERY LOG
+
+/**
+ * Allocates an empty log segment
+ * @param base Offset of its first entry
+ * @return New segment
+ */
+static LogSegment* Log_NewSegment(long base) {
+    LogSegment *seg = (LogSegment*) Mem_Alloc(&E->PS.segment);
+    seg->base = base;
+    seg->count = 0;
+    seg->refs = 0;
+    seg->next = NULL;
+    seg->prev = NULL;
+    return seg;
+}
+
+/**
+ * Initializes a group's delivery log (append-only, shared by its subs)
+ * @param g Group
+ */
+void Log_Init(Group *g) {
+    g->glog = Log_NewSegment(0);
+    g->gtail = g->glog;
+    g->gend = 0;
+}
+
+/**
+ * Appends a pruned info to a group's log
+ * The tail always has room, so every offset up to gend lies in a segment
+ * @param g Group
+ * @param id Info id
+ * @param tm Info tm
+ */
+void Log_Append(Group *g, int id, int tm) {
+    LogSegment *t = g->gtail;
+    t->items[t->count].id = id;
+    t->items[t->count].tm = tm;
+    t->count++;
+    g->gend++;
+    if (t->count == LOG_SEGMENT) {
+        t->next = Log_NewSegment(g->gend);
+        t->next->prev = t;
+        g->gtail = t->next;
+    }
+}
+
+/**
+ * Moves a sub's pin to the segment holding the group's newest entry
+ * That is the tail, or the one before it when the tail is still empty
+ * @param g Group (with at least one entry)
+ * @param pin Pinned segment of the sub
+ */
+void Log_Repin(Group *g, LogSegment **pin) {
+    LogSegment *seg = g->gtail;
+    if (seg->count == 0) seg = seg->prev;
+    if (seg != *pin) {
+        (*pin)->refs--;
+        seg->refs++;
+        *pin = seg;
+    }
+}
+
+/**
+ * Moves a sub's pin forward to the segment holding an offset
+ * @param pin Pinned segment of the sub
+ * @param off New offset to be kept alive (not before the pin)
+ */
+void Log_Advance(LogSegment **pin, long off) {
+    LogSegment *seg = *pin;
+    while (off >= seg->base + LOG_SEGMENT)
+        seg = seg->next;
+    if (seg != *pin) {
+        (*pin)->refs--;
+        seg->refs++;
+        *pin = seg;
+    }
+}
+
+/**
+ * Frees the oldest log segments that no sub pins anymore
+ * Once the group has no subs, the tail's entries are released as well
+ * and it starts over empty at the end of the log
+ * @param g Group
+ */
+void Log_Reclaim(Group *g) {
+    LogSegment *seg;
+    int i;
+    while (g->glog != g->gtail && g->glog->refs == 0) {
+        seg = g->glog;
+        Index_Lock();
+        for (i = 0; i < seg->count; i++)
+            Index_Release(seg->items[i].id);
+        Index_Unlock();
+        g->glog = seg->next;
+        g->glog->prev = NULL;
+        Mem_Free(&E->PS.segment, seg);
+    }
+    seg = g->gtail;
+    if (g->gsub == NULL && g->glog == seg && seg->count > 0) {
+        Index_Lock();
+        for (i = 0; i < seg->count; i++)
+            Index_Release(seg->items[i].id);
+        Index_Unlock();
+        seg->base = g->gend;
+        seg->count = 0;
+    }
+}
+
+/**
+ * Returns the log entry at an offset
+ * @param seg Any segment near the offset
+ * @param off Offset of the entry (must not be reclaimed)
+ * @return Log entry
+ */
+TimeEntry *Log_At(LogSegment *seg, long off) {
+    while (off < seg->base) seg = seg->prev;
+    while (off >= seg->base + LOG_SEGMENT) seg = seg->next;
+    return &seg->items[off - seg->base];
+}
+
+/**
+ * Hands a range of a group's log to a callback, one segment run at a time
+ * @param seg Segment holding the start of the range or any one before it
+ * @param from First offset of the range
+ * @param to Offset past the range
+ * @param gId Group id passed to the callback
+ * @param cb Callback
+ * @param ctx Passed to the callback
+ */
+void Log_Runs(LogSegment *seg, long from, long to, int gId, ConsumeCallback cb, void *ctx) {
+    long end;
+    while (from < to) {
+        while (from >= seg->base + LOG_SEGMENT) seg = seg->next;
+        end = seg->base + seg->count;
+        if (end > to) end = to;
+        cb(gId, &seg->items[from - seg->base], (int) (end - from), ctx);
+        from = end;
+    }
+}
+
+/**
+ * Frees a group's log
+ * @param g Group
+ */
+void Log_Free(Group *g) {
+    LogSegment *seg = g->glog, *next;
+    while (seg != NULL) {
+        next = seg->next;
+        Mem_Free(&E->PS.segment, seg);
+        seg = next;
+    }
+    g->glog = NULL;
+    g->gtail = NULL;
+    g->gend = 0;
+}
+
+// MERGE
+
+/**
+ * Checks if a merge head comes before another
+ * Copies of an info compare equal up to their group, so they end up next
+ * to each other at the top of the heap
+ * @param a Merge head
+ * @param b Merge head
+ * @return True if a comes first
+ */
+static bool Merge_Less(MergeHead a, MergeHead b) {
+    if (a.e.tm != b.e.tm) return a.e.tm < b.e.tm;
+    if (a.e.id != b.e.id) return a.e.id < b.e.id;
+    return a.sg < b.sg;
+}
+
+/**
+ * Restores the heap below a position
+ * @param h Merge heap
+ * @param i Position
+ */
+static void Merge_Down(Merge *h, int i) {
+    int child;
+    MergeHead x = h->heap[i];
+    while ((child = 2*i+1) < h->n) {
+        if (child+1 < h->n && Merge_Less(h->heap[child+1], h->heap[child])) child++;
+        if (!Merge_Less(h->heap[child], x)) break;
+        h->heap[i] = h->heap[child];
+        i = child;
+    }
+    h->heap[i] = x;
+}
+
+/**
+ * Consumes the head of the group at the top of the heap
+ * and replaces it with the group's next pending info
+ * @param h Merge heap (not empty)
+ * @param sub Sub being merged
+ */
+static void Merge_Advance(Merge *h, SubInfo *sub) {
+    SubGroup *sg = &sub->sgs[h->heap[0].sg];
+    long off = SubGroup_Next(sg);
+    // The cursor and its pin follow
+    sg->sgp = off;
+    Log_Advance(&sg->spin, off);
+    if (off+1 < E->G[sg->gs].gend)
+        h->heap[0].e = *Log_At(sg->spin, off+1);
+    else
+        h->heap[0] = h->heap[--h->n];
+    if (h->n > 0) Merge_Down(h, 0);
+}
+
+/**
+ * Starts merging the pending infos of a sub's groups (a heap of their heads)
+ * @param h Merge heap (reused across subs)
+ * @param sub Sub
+ */
+void Merge_Start(Merge *h, SubInfo *sub) {
+    int i;
+    long off;
+    SubGroup *sg;
+    if (h->cap < sub->sgn) {
+        h->cap = sub->sgn;
+        h->heap = (MergeHead*) realloc(h->heap, h->cap*sizeof(MergeHead));
+    }
+    h->n = 0;
+    for (i=0; i<sub->sgn; i++) {
+        sg = &sub->sgs[i];
+        off = SubGroup_Next(sg);
+        if (off >= E->G[sg->gs].gend) continue;
+        h->heap[h->n].e = *Log_At(sg->spin, off);
+        h->heap[h->n].sg = i;
+        h->n++;
+    }
+    for (i=h->n/2-1; i>=0; i--)
+        Merge_Down(h, i);
+}
+
+/**
+ * Consumes the oldest pending info of a sub across its groups
+ * Copies of it that are at the head of other groups are consumed with it
+ * @param h Merge heap started for the sub
+ * @param sub Sub
+ * @param d Filled with the info and the smallest gid it was found in
+ * @return False if nothing is pending
+ */
+bool Merge_Next(Merge *h, SubInfo *sub, Delivery *d) {
+    TimeEntry e;
+    if (h->n == 0) return false;
+    e = h->heap[0].e;
+    d->gId = sub->sgs[h->heap[0].sg].gId;
+    d->iId = e.id;
+    d->itm = e.tm;
+    do {
+        Merge_Advance(h, sub);
+    } while (h->n > 0 && h->heap[0].e.id == e.id && h->heap[0].e.tm == e.tm);
+    return true;
+}
+
+/**
+ * Frees a merge heap
+ * @param h Merge heap
+ */
+void Merge_Free(Merge *h) {
+    free(h->heap);
+    h->heap = NULL;
+    h->n = 0;
+    h->cap = 0;
+}
+
+// POOLS
+
+/**
+ * Initializes an empty pool
+ * @param pool Pool
+ * @param size Size of its objects
+ */
+static void Pool_Init(Pool *pool, size_t size) {
+    // Objects hold the free list link while free and stay 16 byte aligned
+    pool->size = (size + 15) & ~(size_t) 15;
+    pool->free = NULL;
+    pool->blocks = NULL;
+}
+
+/**
+ * Takes an object from a pool, carving a new slab when it's empty
+ * @param pool Pool
+ * @return Object
+ */
+static void *Pool_Alloc(Pool *pool) {
+    PoolBlock *b;
+    char *p;
+    void *obj;
+    int i;
+    if (pool->free == NULL) {
+        b = (PoolBlock*) malloc(sizeof(PoolBlock) + POOL_BLOCK*pool->size);
+        if (b == NULL) return NULL;
+        b->next = pool->blocks;
+        pool->blocks = b;
+        // Threads the slab's objects on the free list
+        p = (char*) (b+1);
+        for (i = POOL_BLOCK-1; i >= 0; i--) {
+            *(void**) (p + i*pool->size) = pool->free;
+            pool->free = p + i*pool->size;
+        }
+    }
+    obj = pool->free;
+    pool->free = *(void**) obj;
+    return obj;
+}
+
+/**
+ * Returns an object to its pool
+ * @param pool Pool
+ * @param p Object
+ */
+static void Pool_Free(Pool *pool, void *p) {
+    *(void**) p = pool->free;
+    pool->free = p;
+}
+
+/**
+ * Frees all the slabs of a pool (and every object in them)
+ * @param pool Pool
+ */
+static void Pool_Release(Pool *pool) {
+    PoolBlock *b = pool->blocks, *next;
+    while (b != NULL) {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+    pool->free = NULL;
+    pool->blocks = NULL;
+}
+
+/**
+ * Initializes the node allocators
+ * @param enabled Non zero to allocate nodes from slab pools, zero for malloc
+ */
+void Pools_Init(int enabled) {
+    int k;
+    E->PS.enabled = enabled;
+    Pool_Init(&E->PS.info, sizeof(Info));
+    Pool_Init(&E->PS.sub, sizeof(Sub));
+    Pool_Init(&E->PS.subinfo, sizeof(SubInfo));
+    Pool_Init(&E->PS.segment, sizeof(LogSegment));
+    for (k = 0; k < POOL_CLASSES; k++)
+        Pool_Init(&E->PS.sized[k], (size_t) 16 << k);
+    E->PS.large = NULL;
+}
+
+/**
+ * Frees every pooled node at once
+ */
+void Pools_Release(void) {
+    PoolLarge *l = E->PS.large, *next;
+    int k;
+    Pool_Release(&E->PS.info);
+    Pool_Release(&E->PS.sub);
+    Pool_Release(&E->PS.subinfo);
+    Pool_Release(&E->PS.segment);
+    for (k = 0; k < POOL_CLASSES; k++)
+        Pool_Release(&E->PS.sized[k]);
+    while (l != NULL) {
+        next = l->next;
+        free(l);
+        l = next;
+    }
+    E->PS.large = NULL;
+}
+
+/**
+ * Allocates a node of a pooled type
+ * @param pool Pool of the type
+ * @return Node
+ */
+void *Mem_Alloc(Pool *pool) {
+    void *p;
+    if (!E->PS.enabled) return malloc(pool->size);
+    Pools_Lock();
+    p = Pool_Alloc(pool);
+    Pools_Unlock();
+    return p;
+}
+
+/**
+ * Frees a node of a pooled type
+ * @param pool Pool of the type
+ * @param p Node
+ */
+void Mem_Free(Pool *pool, void *p) {
+    if (!E->PS.enabled) {
+        free(p);
+        return;
+    }
+    Pools_Lock();
+    Pool_Free(pool, p);
+    Pools_Unlock();
+}
+
+/**
+ * Returns the size class of a variable sized node
+ * @param size Size of the node
+ * @return Size class or POOL_CLASSES if it's too big for them
+ */
+static int Mem_Class(size_t size) {
+    int k = 0;
+    while (k < POOL_CLASSES && ((size_t) 16 << k) < size) k++;
+    return k;
+}
+
+/**
+ * Allocates a variable sized node (group lists, sub's group states)
+ * @param size Size of the node
+ * @return Node
+ */
+void *Mem_AllocSize(size_t size) {
+    PoolLarge *l;
+    void *p;
+    int k;
+    if (!E->PS.enabled) return malloc(size > 0 ? size : 1);
+    k = Mem_Class(size);
+    if (k < POOL_CLASSES) {
+        Pools_Lock();
+        p = Pool_Alloc(&E->PS.sized[k]);
+        Pools_Unlock();
+        return p;
+    }
+    // Too big for the slabs: Kept in a list to be released in bulk
+    l = (PoolLarge*) malloc(sizeof(PoolLarge) + size);
+    if (l == NULL) return NULL;
+    Pools_Lock();
+    l->prev = NULL;
+    l->next = E->PS.large;
+    if (E->PS.large != NULL) E->PS.large->prev = l;
+    E->PS.large = l;
+    Pools_Unlock();
+    return l+1;
+}
+
+/**
+ * Frees a variable sized node
+ * @param p Node (may be NULL)
+ * @param size Size it was allocated with
+ */
+void Mem_FreeSize(void *p, size_t size) {
+    PoolLarge *l;
+    int k;
+    if (p == NULL) return;
+    if (!E->PS.enabled) {
+        free(p);
+        return;
+    }
+    k = Mem_Class(size);
+    Pools_Lock();
+    if (k < POOL_CLASSES) {
+        Pool_Free(&E->PS.sized[k], p);
+        Pools_Unlock();
+        return;
+    }
+    l = (PoolLarge*) p - 1;
+    if (l->prev != NULL) l->prev->next = l->next;
+    else E->PS.large = l->next;
+    if (l->next != NULL) l->next->prev = l->prev;
+    Pools_Unlock();
+    free(l);
+}
+
+// INDEX
+
+/**
+ * Returns the home slot of an id in the info id index
+ * @param id Info id
+ * @param cap Capacity of the index (power of 2)
+ * @return Slot index
+ */
+static int Index_Slot(int id, int cap) {
+    unsigned int h = (unsigned int) id * 2654435769u; // Fibonacci hashing
+    return (int) (h & (unsigned int) (cap-1));
+}
+
+/**
+ * Initializes the info id index (open addressing, linear probing)
+ * @param cap Initial capacity, rounded up to a power of 2
+ */
+void Index_Init(int cap) {
+    int i, c = 16;
+    while (c < cap) c<<=1;
+    E->IDX.slots = (IdSlot*) malloc(c*sizeof(IdSlot));
+    for (i=0; i<c; i++) E->IDX.slots[i].id = -1;
+    E->IDX.cap = c;
+    E->IDX.size = 0;
+}
+
+/**
+ * Doubles the capacity of the info id index
+ */
+static void Index_Grow(void) {
+    IdSlot *old = E->IDX.slots;
+    int i, j, oldcap = E->IDX.cap;
+    E->IDX.cap = oldcap*2;
+    E->IDX.slots = (IdSlot*) malloc(E->IDX.cap*sizeof(IdSlot));
+    for (i=0; i<E->IDX.cap; i++) E->IDX.slots[i].id = -1;
+    for (i=0; i<oldcap; i++) {
+        if (old[i].id == -1) continue;
+        j = Index_Slot(old[i].id, E->IDX.cap);
+        while (E->IDX.slots[j].id != -1) j = (j+1) & (E->IDX.cap-1);
+        E->IDX.slots[j] = old[i];
+    }
+    free(old);
+}
+
+/**
+ * Finds the slot holding an id
+ * @param id Info id
+ * @return Slot index or -1 if the id is not indexed
+ */
+static int Index_Find(int id) {
+    int i = Index_Slot(id, E->IDX.cap);
+    while (E->IDX.slots[i].id != -1) {
+        if (E->IDX.slots[i].id == id) return i;
+        i = (i+1) & (E->IDX.cap-1);
+    }
+    return -1;
+}
+
+/**
+ * Adds a reference to an id, inserting it if needed
+ * @param id Info id
+ */
+void Index_Acquire(int id) {
+    int i;
+    if ((E->IDX.size+1)*4 > E->IDX.cap*3) Index_Grow(); // Keeps load factor under 0.75
+    i = Index_Slot(id, E->IDX.cap);
+    while (E->IDX.slots[i].id != -1 && E->IDX.slots[i].id != id)
+        i = (i+1) & (E->IDX.cap-1);
+    if (E->IDX.slots[i].id == -1) {
+        E->IDX.slots[i].id = id;
+        E->IDX.slots[i].refs = 0;
+        E->IDX.size++;
+    }
+    E->IDX.slots[i].refs++;
+}
+
+/**
+ * Drops a reference to an id, removing it when none are left
+ * @param id Info id
+ */
+void Index_Release(int id) {
+    int i, j, h;
+    i = Index_Find(id);
+    if (i == -1 || --E->IDX.slots[i].refs > 0) return;
+    // Backward shift deletion (keeps probe chains intact without tombstones)
+    j = i;
+    while (1) {
+        E->IDX.slots[i].id = -1;
+        do {
+            j = (j+1) & (E->IDX.cap-1);
+            if (E->IDX.slots[j].id == -1) {
+                E->IDX.size--;
+                return;
+            }
+            h = Index_Slot(E->IDX.slots[j].id, E->IDX.cap);
+        } while ((i<=j) ? (i<h && h<=j) : (i<h || h<=j));
+        E->IDX.slots[i] = E->IDX.slots[j];
+        i = j;
+    }
+}
+
+/**
+ * Checks if an id is indexed
+ * @param id Info id
+ * @return True if it is indexed
+ */
+bool Index_Contains(int id) {
+    return Index_Find(id) != -1;
+}
+
+/**
+ * Frees the info id index
+ */
+void Index_Free(void) {
+    free(E->IDX.slots);
+    E->IDX.slots = NULL;
+    E->IDX.cap = 0;
+    E->IDX.size = 0;
+}
+
+// PRINT
+
+/**
+ * Prints what a prune changed: For every group that had expired infos,
+ * the infos moved out of its tree, the subs they were delivered to and
+ * the new end of its log
+ * @param res Prune result
+ */
+void Prune_Print(const PruneResult *res) {
+    const PruneGroup *pg;
+    int i, j;
+    Out_Begin('R');
+    Out_Text("R DONE\n");
+    Out_Open("groups", '[');
+    for (i = 0; i < res->ngroups; i++) {
+        pg = &res->groups[i];
+        Out_Open(NULL, '{');
+        Out_Text("    GROUPID = ");
+        Out_Int("gid", pg->gId);
+        Out_Text(", PRUNED =");
+        Out_Open("infos", '[');
+        for (j = 0; j < pg->nmoves; j++)
+            Out_Item(res->moves[pg->moves + j].iId);
+        Out_Close();
+        Out_Text(", SUBLIST =");
+        Out_Open("subs", '[');
+        for (j = 0; j < pg->nsubs; j++)
+            Out_Item(res->subs[pg->subs + j]);
+        Out_Close();
+        Out_Text(", LOGEND = ");
+        Out_Long("logend", pg->gend);
+        Out_Text("\n");
+        Out_Close();
+    }
+    Out_Close();
+    Out_End();
+}
+
+/**
+ * Handles printing process of a group after consume event
+ * @param sg Sub's state for the group
+ * @param preConsume Consumption point before consuming
+ */
+void Consume_Print(SubGroup *sg, long preConsume) {
+    Group *g = &E->G[sg->gs];
+    if (E->OUT.format==OUTPUT_NONE) return;
+    Out_Open(NULL, '{');
+    Out_Text("    GROUPID = ");
+    Out_Int("gid", g->gId);
+    Out_Text(", TREELIST =");
+    Out_Open("infos", '[');
+    Consume_Print_Info(g, g->gend-1, (preConsume==-1)?sg->tgp:preConsume);
+    Out_Close();
+    Out_Text(", NEWGP = ");
+    if (sg->sgp!=-1)
+        Out_Int("newgp", Log_At(sg->spin, sg->sgp)->id);
+    Out_Text("\n");
+    Out_Close();
+}
+
+/**
+ * Print a group's log between two points (newer to older)
+ * @param g Group
+ * @param hi Starting point (including it)
+ * @param lo Ending point (including it)
+ */
+void Consume_Print_Info(Group *g, long hi, long lo) {
+    LogSegment *seg = g->gtail;
+    long off;
+    for (off = hi; off >= lo; off--) {
+        while (off < seg->base) seg = seg->prev;
+        Out_Item(seg->items[off - seg->base].id);
+    }
+}
+
+/**
+ * Print a group's log from a point on (what a sub has received)
+ * @param g Group
+ * @param from Starting point (Older entries may have been reclaimed)
+ */
+void Consumption_Print(Group *g, long from) {
+    LogSegment *seg;
+    int i;
+    for (seg = g->glog; seg != NULL; seg = seg->next) {
+        for (i = 0; i < seg->count; i++) {
+            if (seg->base + i >= from)
+                Out_Item(seg->items[i].id);
+        }
+    }
+}
+
+/**
+ * Prints the ids of every sub (SUBSCRIBERLIST)
+ * @param label Text before the list
+ */
+static void Print_Subscribers(const char *label) {
+    SubInfo* ptr;
+    HashIter it;
+    Out_Text(label);
+    Out_Open("subscribers", '[');
+    for (ptr = Hash_First(&it); ptr != NULL; ptr = Hash_Next(&it))
+        Out_Item(ptr->sId);
+    Out_Close();
+    Out_Text("\n");
+}
+
+/**
+ * Prints the sub lists of a sub's groups
+ * @param sgs Sub's group states
+ * @param sgn Number of sub's groups
+ */
+static void Print_Group_Subs(SubGroup *sgs, int sgn) {
+    int i;
+    Sub* s;
+    Out_Open("groups", '[');
+    for (i=0; i<sgn; i++) {
+        Out_Open(NULL, '{');
+        Out_Text("    GROUPID = ");
+        Out_Int("gid", sgs[i].gId);
+        Out_Text(", SUBLIST =");
+        Out_Open("subs", '[');
+        s = E->G[sgs[i].gs].gsub;
+        while (s != NULL) {
+            Out_Item(s->sId);
+            s = s->snext;
+        }
+        Out_Close();
+        Out_Text("\n");
+        Out_Close();
+    }
+    Out_Close();
+}
+
+/**
+ * Handles printing process after a subscriber deletion event
+ * @param sId Sub id deleted
+ * @param sgs Sub's group states
+ * @param sgn Number of sub's groups
+ */
+void Delete_Subscriber_Print(int sId, SubGroup *sgs, int sgn) {
+    if (E->OUT.format==OUTPUT_NONE) return;
+    Out_Begin('D');
+    Out_Text("D ");
+    Out_Int("sid", sId);
+    Out_Text(" DONE\n");
+    Print_Subscribers("    SUBSCRIBERLIST =");
+    Print_Group_Subs(sgs, sgn);
+    Out_End();
+}
+
+/**
+ * Handles printing process after a subscriber registration event
+ * @param sub Registered sub
+ */
+void Subscriber_Registration_Print(SubInfo *sub) {
+    int i;
+    if (E->OUT.format==OUTPUT_NONE) return;
+    Out_Begin('S');
+    Out_Text("S ");
+    Out_Int("tm", sub->stm);
+    Out_Text(" ");
+    Out_Int("sid", sub->sId);
+    Out_Open("gids", '[');
+    for (i=0; i<sub->sgn; i++)
+        Out_Item(sub->sgs[i].gId);
+    Out_Close();
+    Out_Text(" DONE\n");
+    Print_Subscribers("    SUBSCRIBERLIST = ");
+    Print_Group_Subs(sub->sgs, sub->sgn);
+    Out_End();
+}
+
+/**
+ * Prints group's info tree (in order, walking up through parent pointers)
+ * @param T Info list
+ */
+void printGroupInfo(Info *T) {
+    Info *p = T, *par;
+    if (p==NULL) return;
+    while (p->ilc!=NULL) p=p->ilc;
+    while (p!=NULL) {
+        Out_Item(p->iId);
+        // Next in order: Leftmost node of the right subtree, or the first
+        // ancestor reached from its left subtree
+        if (p->irc!=NULL) {
+            p=p->irc;
+            while (p->ilc!=NULL) p=p->ilc;
+        } else {
+            par=p->ip;
+            while (p!=T && par->irc==p) {
+                p=par;
+                par=p->ip;
+            }
+            p=(p==T)?NULL:par;
+        }
+    }
+}
+
+/**
+ * Handles printing process after an info insertion event
+ * @param iTM Info tm
+ * @param iId Info id
+ * @param gids_arr Groups the info is associated with
+ * @param size_of_gids_arr Size of gids_arr
+ */
+void Insert_Info_Print(int iTM,int iId, const int *gids_arr, int size_of_gids_arr) {
+    int i;
+    Info* p;
+    if (E->OUT.format==OUTPUT_NONE) return;
+    Out_Begin('I');
+    Out_Text("I ");
+    Out_Int("tm", iTM);
+    Out_Text(" ");
+    Out_Int("id", iId);
+    Out_Text(" DONE\n");
+    Out_Open("groups", '[');
+    for (i=0; i<size_of_gids_arr; i++) {
+        if (gids_arr[i]!=-2) {
+            Out_Open(NULL, '{');
+            Out_Text("    GROUPID = ");
+            Out_Int("gid", E->G[gids_arr[i]].gId);
+            Out_Text(", INFOLIST =");
+            Out_Open("infos", '[');
+            Group_Lock(&E->G[gids_arr[i]]);
+            p = E->G[gids_arr[i]].gr;
+            printGroupInfo(p);
+            Group_Unlock(&E->G[gids_arr[i]]);
+            Out_Close();
+            Out_Text("\n");
+            Out_Close();
+        }
+    }
+    Out_Close();
+    Out_End();
+}
+
+// OUTPUT
+
+/**
+ * Initializes the output writer
+ * @param format OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_BINARY or OUTPUT_NONE
+ */
+void Out_Init(int format) {
+    E->OUT.format = format;
+    E->OUT.cap = (format==OUTPUT_NONE) ? 0 : 2*OUTPUT_FLUSH;
+    E->OUT.buf = (format==OUTPUT_NONE) ? NULL : (char*) malloc(E->OUT.cap);
+    E->OUT.len = 0;
+    E->OUT.block = 0;
+    E->OUT.depth = 0;
+    E->OUT.sink = NULL;
+    E->OUT.ctx = NULL;
+}
+
+/**
+ * Returns the writer events are rendered with
+ * Threads render into their own and hand whole events to OUT
+ * @return Writer
+ */
+static Output *Out_Self(void) {
+    return E->THREADSAFE ? &Local_Get()->out : &E->OUT;
+}
+
+/**
+ * Writes the buffered output
+ */
+static void Out_Flush(void) {
+    if (E->OUT.len == 0) return;
+    if (E->OUT.sink != NULL) {
+        E->OUT.sink(E->OUT.buf, E->OUT.len, E->OUT.ctx);
+    } else {
+        fwrite(E->OUT.buf, 1, E->OUT.len, stdout);
+        fflush(stdout);
+    }
+    E->OUT.len = 0;
+}
+
+void Output_Sink(OutputSink sink, void *ctx) {
+    pthread_mutex_lock(&E->OUTPUT_LOCK);
+    Out_Flush();
+    E->OUT.sink = sink;
+    E->OUT.ctx = ctx;
+    pthread_mutex_unlock(&E->OUTPUT_LOCK);
+}
+
+/**
+ * Writes pending output and frees the writer's buffer
+ */
+void Out_Free(void) {
+    Out_Flush();
+    free(E->OUT.buf);
+    E->OUT.buf = NULL;
+    E->OUT.cap = 0;
+}
+
+/**
+ * Makes room in a writer's buffer
+ * @param o Writer
+ * @param n Bytes needed
+ */
+static void Out_Reserve(Output *o, size_t n) {
+    if (o->len + n <= o->cap) return;
+    while (o->len + n > o->cap) o->cap *= 2;
+    o->buf = (char*) realloc(o->buf, o->cap);
+}
+
+/**
+ * Appends bytes to a writer's buffer
+ * @param o Writer
+ * @param s Bytes
+ * @param n Number of bytes
+ */
+static void Out_Put(Output *o, const char *s, size_t n) {
+    Out_Reserve(o, n);
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+/**
+ * Appends an integer in decimal
+ * @param o Writer
+ * @param v Integer
+ */
+static void Out_Decimal(Output *o, long v) {
+    char tmp[21];
+    int n = 21;
+    unsigned long u = (v < 0) ? 0ul - (unsigned long) v : (unsigned long) v;
+    do {
+        tmp[--n] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (v < 0) tmp[--n] = '-';
+    Out_Put(o, tmp + n, (size_t) (21 - n));
+}
+
+/**
+ * Appends an integer as a zigzag varint (binary format)
+ * Integers that fit in an int take the same bytes as before
+ * @param o Writer
+ * @param v Integer
+ */
+static void Out_Varint(Output *o, long v) {
+    unsigned long u = ((unsigned long) v << 1) ^ (unsigned long) -(v < 0);
+    Out_Reserve(o, 10);
+    while (u >= 0x80) {
+        o->buf[o->len++] = (char) (u | 0x80);
+        u >>= 7;
+    }
+    o->buf[o->len++] = (char) u;
+}
+
+/**
+ * Starts a value of structured output (separator and key)
+ * @param o Writer
+ * @param key Key of the value (NULL inside lists)
+ */
+static void Out_Key(Output *o, const char *key) {
+    if (!o->first[o->depth]) Out_Put(o, ",", 1);
+    o->first[o->depth] = 0;
+    if (key != NULL) {
+        Out_Put(o, "\"", 1);
+        Out_Put(o, key, strlen(key));
+        Out_Put(o, "\":", 2);
+    }
+}
+
+/**
+ * Starts the output block of an event
+ * Text: nothing, JSON: an object per line, Binary: event byte and block length
+ * @param event Event char
+ */
+void Out_Begin(char event) {
+    Output *o;
+    if (E->OUT.format == OUTPUT_NONE) return;
+    o = Out_Self();
+    o->block = o->len;
+    o->depth = 0;
+    o->kind[0] = '{';
+    o->first[0] = 0;
+    if (o->format == OUTPUT_JSON) {
+        Out_Put(o, "{\"event\":\"", 10);
+        Out_Put(o, &event, 1);
+        Out_Put(o, "\"", 1);
+    } else if (o->format == OUTPUT_BINARY) {
+        Out_Put(o, &event, 1);
+        Out_Put(o, "\0\0\0\0", 4);
+    }
+}
+
+/**
+ * Ends the output block of an event, writing the buffer if it is full
+ */
+void Out_End(void) {
+    size_t n;
+    int i;
+    Output *o;
+    if (E->OUT.format == OUTPUT_NONE) return;
+    o = Out_Self();
+    if (o->format == OUTPUT_JSON) {
+        Out_Put(o, "}\n", 2);
+    } else if (o->format == OUTPUT_BINARY) {
+        // Little endian length of the block's tokens
+        n = o->len - o->block - 5;
+        for (i = 0; i < 4; i++)
+            o->buf[o->block + 1 + i] = (char) (n >> (8*i));
+    }
+    if (o != &E->OUT) {
+        // Hands the whole event over, so events of threads don't interleave
+        pthread_mutex_lock(&E->OUTPUT_LOCK);
+        Out_Put(&E->OUT, o->buf, o->len);
+        if (E->OUT.len >= OUTPUT_FLUSH || E->OUT.sink != NULL) Out_Flush();
+        pthread_mutex_unlock(&E->OUTPUT_LOCK);
+        o->len = 0;
+        return;
+    }
+    if (E->OUT.len >= OUTPUT_FLUSH || E->OUT.sink != NULL) Out_Flush();
+}
+
+/**
+ * Appends text that only the text format has
+ * @param s Text
+ */
+void Out_Text(const char *s) {
+    if (E->OUT.format == OUTPUT_TEXT) Out_Put(Out_Self(), s, strlen(s));
+}
+
+/**
+ * Appends an integer value
+ * @param key Key of the value (NULL inside lists)
+ * @param v Value
+ */
+void Out_Int(const char *key, int v) {
+    Out_Long(key, v);
+}
+
+/**
+ * Appends a long integer value
+ * @param key Key of the value (NULL inside lists)
+ * @param v Value
+ */
+void Out_Long(const char *key, long v) {
+    Output *o;
+    if (E->OUT.format == OUTPUT_NONE) return;
+    o = Out_Self();
+    switch (o->format) {
+    case OUTPUT_TEXT:
+        Out_Decimal(o, v);
+        break;
+    case OUTPUT_JSON:
+        Out_Key(o, key);
+        Out_Decimal(o, v);
+        break;
+    case OUTPUT_BINARY:
+        Out_Put(o, "\1", 1);
+        Out_Varint(o, v);
+        break;
     }
-    return true;
 }
 
+/**
+ * Appends a list item (" %d" in the text format)
+ * @param v Value
+ */
+void Out_Item(int v) {
+    Output *o;
+    if (E->OUT.format == OUTPUT_TEXT) {
+        o = Out_Self();
+        Out_Reserve(o, 1);
+        o->buf[o->len++] = ' ';
+        Out_Decimal(o, v);
+    } else {
+        Out_Int(NULL, v);
+    }
+}
 
-TreeInfo* Consumption_LookUp(TreeInfo* T, int tm, int id) {
-    TreeInfo *p=T;
-    while(p!=NULL && p->ttm!=tm) {
-        if (p->tlc==NULL && p->tId==id)
-            return p;
-        else if (p->ttm<tm)
-            p=p->trc;
-        else
-            p=p->tlc;
+/**
+ * Opens a list or an object (structured formats only)
+ * @param key Key of the value (NULL inside lists)
+ * @param kind '[' for a list, '{' for an object
+ */
+void Out_Open(const char *key, char kind) {
+    Output *o;
+    if (E->OUT.format != OUTPUT_JSON && E->OUT.format != OUTPUT_BINARY) return;
+    o = Out_Self();
+    if (o->format == OUTPUT_JSON) {
+        Out_Key(o, key);
+        Out_Put(o, &kind, 1);
+    } else {
+        Out_Put(o, kind == '[' ? "\2" : "\3", 1);
     }
-    return NULL;
+    o->depth++;
+    o->kind[o->depth] = kind;
+    o->first[o->depth] = 1;
 }
 
-// PRINT
+/**
+ * Closes the last opened list or object
+ */
+void Out_Close(void) {
+    Output *o;
+    if (E->OUT.format != OUTPUT_JSON && E->OUT.format != OUTPUT_BINARY) return;
+    o = Out_Self();
+    if (o->format == OUTPUT_JSON)
+        Out_Put(o, o->kind[o->depth] == '[' ? "]" : "}", 1);
+    else
+        Out_Put(o, "\4", 1);
+    o->depth--;
+}
+
+// LOCKING
+
+/**
+ * Locks the engine (does nothing unless it was configured thread safe)
+ * Events on groups and subs that exist share it, the rest own it
+ * @param exclusive True to own it
+ */
+void Engine_Lock(int exclusive) {
+    if (!E->THREADSAFE) return;
+    if (exclusive) pthread_rwlock_wrlock(&E->ENGINE_LOCK);
+    else pthread_rwlock_rdlock(&E->ENGINE_LOCK);
+}
 
 /**
- * Handles printing process after consume event
- * @param sub Sub who requested consume
- * @param preConsume Their Consumption tree before consuming
- */
-void Consume_Print(SubInfo *sub, TreeInfo** preConsume) {
-    int i, id;
-    id = sub->sId;
-    printf("C %d DONE\n", id);
-    for (i=0; i<MG; i++) {
-        if (preConsume[i] != (TreeInfo *) 1) {
-            printf("    GROUPID = %d, TREELIST =", G[i].gId);
-            Consume_Print_Info(sub->tgp[i], (preConsume[i]==NULL)?NULL:preConsume[i]->prev);
-            printf(", NEWGP = ");
-            if (sub->sgp[i]!=NULL)
-                printf("%d", sub->sgp[i]->tId);
-            printf("\n");
+ * Locks the engine for an event on some groups
+ * Shared if they are all registered, owned if some must be registered
+ * @param gids_arr Group ids of the event
+ * @param size_of_gids_arr Size of gids_arr including -1
+ */
+void Engine_LockGroups(const int *gids_arr, int size_of_gids_arr) {
+    int i;
+    if (!E->THREADSAFE) return;
+    pthread_rwlock_rdlock(&E->ENGINE_LOCK);
+    for (i=0; i<size_of_gids_arr-1; i++) {
+        if (gids_arr[i]>=0 && Group_Slot(gids_arr[i])==-1) {
+            pthread_rwlock_unlock(&E->ENGINE_LOCK);
+            pthread_rwlock_wrlock(&E->ENGINE_LOCK);
+            return;
         }
     }
 }
 
 /**
- * Print consumption tree until a certain point (newer to older)
- * @param info Consumption Tree
- * @param end Ending point (including it)
+ * Unlocks the engine
  */
-void Consume_Print_Info(TreeInfo *info, TreeInfo *end) {
-    TreeInfo* p = info;
-    if (p==NULL) return;
-    while (p->trc != NULL)
-        p = p->trc;
-    while (p != end) {
-        printf(" %d", p->tId);
-        p = p->prev;
+void Engine_Unlock(void) {
+    if (E->THREADSAFE) pthread_rwlock_unlock(&E->ENGINE_LOCK);
+}
+
+/**
+ * Locks a group (its tree, time index, log and its subs' positions in it)
+ * Threads that hold several lock them in gid order
+ * @param g Group
+ */
+void Group_Lock(Group *g) {
+    if (g->glock != NULL) pthread_mutex_lock(g->glock);
+}
+
+/**
+ * Unlocks a group
+ * @param g Group
+ */
+void Group_Unlock(Group *g) {
+    if (g->glock != NULL) pthread_mutex_unlock(g->glock);
+}
+
+/**
+ * Locks every group of a sub (sgs is sorted by gid)
+ * @param sub Sub
+ */
+void Sub_LockGroups(SubInfo *sub) {
+    int i;
+    for (i=0; i<sub->sgn; i++)
+        Group_Lock(&E->G[sub->sgs[i].gs]);
+}
+
+/**
+ * Unlocks every group of a sub
+ * @param sub Sub
+ */
+void Sub_UnlockGroups(SubInfo *sub) {
+    int i;
+    for (i=sub->sgn-1; i>=0; i--)
+        Group_Unlock(&E->G[sub->sgs[i].gs]);
+}
+
+/**
+ * Locks the info id index (no other lock is taken while it is held)
+ * Leaf locks are taken when the engine is thread safe or groups are
+ * being pruned in parallel
+ */
+void Index_Lock(void) {
+    if (E->LEAF_LOCKING) pthread_mutex_lock(&E->INDEX_LOCK);
+}
+
+/**
+ * Unlocks the info id index
+ */
+void Index_Unlock(void) {
+    if (E->LEAF_LOCKING) pthread_mutex_unlock(&E->INDEX_LOCK);
+}
+
+/**
+ * Locks the node pools (no other lock is taken while they are held)
+ */
+void Pools_Lock(void) {
+    if (E->LEAF_LOCKING) pthread_mutex_lock(&E->POOLS_LOCK);
+}
+
+/**
+ * Unlocks the node pools
+ */
+void Pools_Unlock(void) {
+    if (E->LEAF_LOCKING) pthread_mutex_unlock(&E->POOLS_LOCK);
+}
+
+/**
+ * Frees a thread's state (when it exits or by free_all)
+ * @param p Thread's state
+ */
+static void Local_Destroy(void *p) {
+    Local *l = (Local*) p;
+    Engine *e = l->engine;
+    pthread_mutex_lock(&e->OUTPUT_LOCK);
+    if (l->prev != NULL) l->prev->next = l->next;
+    else e->LOCALS = l->next;
+    if (l->next != NULL) l->next->prev = l->prev;
+    pthread_mutex_unlock(&e->OUTPUT_LOCK);
+    free(l->out.buf);
+    Merge_Free(&l->mh);
+    free(l->marks);
+    free(l);
+}
+
+/**
+ * Initializes the engine's locks and the key of the threads' state
+ */
+void Locks_Init(void) {
+    pthread_rwlock_init(&E->ENGINE_LOCK, NULL);
+    pthread_mutex_init(&E->INDEX_LOCK, NULL);
+    pthread_mutex_init(&E->POOLS_LOCK, NULL);
+    pthread_mutex_init(&E->OUTPUT_LOCK, NULL);
+    pthread_mutex_init(&E->GROUPSET_LOCK, NULL);
+    pthread_mutex_init(&E->READY_LOCK, NULL);
+    if (E->THREADSAFE) pthread_key_create(&E->LOCAL_KEY, Local_Destroy);
+}
+
+/**
+ * Frees every thread's state and destroys the engine's locks
+ */
+void Locks_Free(void) {
+    if (E->THREADSAFE) {
+        while (E->LOCALS != NULL) Local_Destroy(E->LOCALS);
+        pthread_key_delete(E->LOCAL_KEY);
     }
+    pthread_rwlock_destroy(&E->ENGINE_LOCK);
+    pthread_mutex_destroy(&E->INDEX_LOCK);
+    pthread_mutex_destroy(&E->POOLS_LOCK);
+    pthread_mutex_destroy(&E->OUTPUT_LOCK);
+    pthread_mutex_destroy(&E->GROUPSET_LOCK);
+    pthread_mutex_destroy(&E->READY_LOCK);
 }
 
 /**
- * Print info list of a consumption tree
- * @param T Consumption Tree
+ * Returns the calling thread's state, creating it on first use
+ * @return Thread's state (freed when the thread exits or by free_all)
  */
-void Consumption_Print(TreeInfo* T) {
-    TreeInfo *p = T;
-    if (T==NULL) return;
-    while (p->tlc!=NULL) p=p->tlc;
-    while (p!=NULL) {
-        printf(" %d", p->tId);
-        p=p->next;
+Local *Local_Get(void) {
+    Local *l = (Local*) pthread_getspecific(E->LOCAL_KEY);
+    if (l != NULL) return l;
+    l = (Local*) calloc(1, sizeof(Local));
+    l->out.format = E->OUT.format;
+    l->out.cap = 4096;
+    l->out.buf = (char*) malloc(l->out.cap);
+    l->engine = E;
+    pthread_mutex_lock(&E->OUTPUT_LOCK);
+    l->next = E->LOCALS;
+    if (l->next != NULL) l->next->prev = l;
+    E->LOCALS = l;
+    pthread_mutex_unlock(&E->OUTPUT_LOCK);
+    pthread_setspecific(E->LOCAL_KEY, l);
+    return l;
+}
+
+/**
+ * Returns the merge heap the calling thread consumes with
+ * @return Merge heap
+ */
+Merge *Merge_Self(void) {
+    return E->THREADSAFE ? &Local_Get()->mh : &E->MH;
+}
+
+// PRUNE WORKERS
+
+/**
+ * Hands out the next group of the prune in progress
+ * @return Group slot or -1 if all of them were handed out
+ */
+static int Prune_Take(void) {
+    int k;
+    pthread_mutex_lock(&E->PW.lock);
+    k = (E->PW.next < E->GN) ? E->PW.next++ : -1;
+    pthread_mutex_unlock(&E->PW.lock);
+    return k;
+}
+
+/**
+ * Prunes groups until none are left to hand out
+ * Groups are handed out in order, so each worker's result is sorted by slot
+ * @param w Worker
+ */
+static void Prune_Work(int w) {
+    PruneResult *res = E->PW.record ? &E->PW.res[w] : NULL;
+    int k, n;
+    while ((k = Prune_Take()) != -1) {
+        n = (res != NULL) ? res->ngroups : 0;
+        pruneTree(E->PW.tm, k, res);
+        if (res != NULL && res->ngroups > n) E->PW.owner[k] = w;
     }
 }
 
 /**
- * Handles printing process after a subscriber deletion event
- * @param sId Sub id deleted
- * @param gids_arr Sub's igp
+ * Body of a helper thread: Joins every parallel prune until stopped
+ * @param arg Engine it prunes for
+ * @return NULL
+ */
+static void *Prune_Helper(void *arg) {
+    int w, gen = 0;
+    E = (Engine*) arg;
+    // Takes the next worker number
+    pthread_mutex_lock(&E->PW.lock);
+    w = ++E->PW.started;
+    pthread_mutex_unlock(&E->PW.lock);
+    while (1) {
+        pthread_mutex_lock(&E->PW.lock);
+        while (!E->PW.stop && E->PW.gen == gen)
+            pthread_cond_wait(&E->PW.work, &E->PW.lock);
+        if (E->PW.stop) {
+            pthread_mutex_unlock(&E->PW.lock);
+            return NULL;
+        }
+        gen = E->PW.gen;
+        pthread_mutex_unlock(&E->PW.lock);
+        Prune_Work(w);
+        pthread_mutex_lock(&E->PW.lock);
+        if (--E->PW.busy == 0) pthread_cond_signal(&E->PW.done);
+        pthread_mutex_unlock(&E->PW.lock);
+    }
+}
+
+/**
+ * Starts the prune workers
+ * @param threads Number of workers, the pruning thread included
  */
-void Delete_Subscriber_Print(int sId, Info **gids_arr) {
+void Prune_Start(int threads) {
     int i;
-    Sub* s;
-    SubInfo* ptr;
-    printf("D %d DONE\n", sId);
-    printf("    SUBSCRIBERLIST =");
-    for (i=0; i<M; i++) {
-        ptr = HT[i];
-        while (ptr!=NULL) {
-            printf(" %d", ptr->sId);
-            ptr=ptr->snext;
+    E->PW.n = (threads > 1) ? threads : 1;
+    if (E->PW.n == 1) return;
+    E->PW.threads = (pthread_t*) malloc((E->PW.n-1)*sizeof(pthread_t));
+    E->PW.res = (PruneResult*) calloc(E->PW.n, sizeof(PruneResult));
+    E->PW.owner = NULL;
+    E->PW.ownercap = 0;
+    E->PW.started = 0;
+    E->PW.gen = 0;
+    E->PW.busy = 0;
+    E->PW.stop = 0;
+    pthread_mutex_init(&E->PW.lock, NULL);
+    pthread_cond_init(&E->PW.work, NULL);
+    pthread_cond_init(&E->PW.done, NULL);
+    for (i = 1; i < E->PW.n; i++)
+        pthread_create(&E->PW.threads[i-1], NULL, Prune_Helper, E);
+}
+
+/**
+ * Stops the prune workers and frees their state
+ */
+void Prune_Stop(void) {
+    int i;
+    if (E->PW.n <= 1) return;
+    pthread_mutex_lock(&E->PW.lock);
+    E->PW.stop = 1;
+    pthread_cond_broadcast(&E->PW.work);
+    pthread_mutex_unlock(&E->PW.lock);
+    for (i = 1; i < E->PW.n; i++)
+        pthread_join(E->PW.threads[i-1], NULL);
+    for (i = 0; i < E->PW.n; i++)
+        PruneResult_Free(&E->PW.res[i]);
+    free(E->PW.threads);
+    free(E->PW.res);
+    free(E->PW.owner);
+    pthread_mutex_destroy(&E->PW.lock);
+    pthread_cond_destroy(&E->PW.work);
+    pthread_cond_destroy(&E->PW.done);
+    memset(&E->PW, 0, sizeof(E->PW));
+}
+
+/**
+ * Prunes every group with all the workers
+ * The workers' results are merged in slot order, so the result is the
+ * same as when the groups are pruned one after another
+ * @param tm Prune tm
+ * @param res Result to record the changes to (NULL to record nothing)
+ */
+void Prune_Parallel(int tm, PruneResult *res) {
+    PruneResult *r;
+    PruneGroup *src, *dst;
+    int i, k, *pos;
+    if (res != NULL && E->PW.ownercap < E->GN) {
+        E->PW.ownercap = E->GN;
+        E->PW.owner = (int*) realloc(E->PW.owner, E->PW.ownercap*sizeof(int));
+    }
+    for (i = 0; res != NULL && i < E->GN; i++) E->PW.owner[i] = -1;
+    for (i = 0; i < E->PW.n; i++) {
+        E->PW.res[i].ngroups = 0;
+        E->PW.res[i].nmoves = 0;
+        E->PW.res[i].nsubs = 0;
+    }
+    // Wakes the helpers and works along with them
+    E->LEAF_LOCKING = 1;
+    pthread_mutex_lock(&E->PW.lock);
+    E->PW.tm = tm;
+    E->PW.record = (res != NULL);
+    E->PW.next = 0;
+    E->PW.busy = E->PW.n-1;
+    E->PW.gen++;
+    pthread_cond_broadcast(&E->PW.work);
+    pthread_mutex_unlock(&E->PW.lock);
+    Prune_Work(0);
+    pthread_mutex_lock(&E->PW.lock);
+    while (E->PW.busy > 0)
+        pthread_cond_wait(&E->PW.done, &E->PW.lock);
+    pthread_mutex_unlock(&E->PW.lock);
+    E->LEAF_LOCKING = E->THREADSAFE;
+    if (res == NULL) return;
+    // Merges the results in slot order (each worker's is already sorted)
+    pos = (int*) calloc(E->PW.n, sizeof(int));
+    for (k = 0; k < E->GN; k++) {
+        if (E->PW.owner[k] == -1) continue;
+        r = &E->PW.res[E->PW.owner[k]];
+        src = &r->groups[pos[E->PW.owner[k]]++];
+        Prune_Reserve((void**) &res->groups, res->ngroups, &res->capgroups, sizeof(PruneGroup));
+        dst = &res->groups[res->ngroups++];
+        *dst = *src;
+        dst->moves = res->nmoves;
+        dst->subs = res->nsubs;
+        for (i = 0; i < src->nmoves; i++) {
+            Prune_Reserve((void**) &res->moves, res->nmoves, &res->capmoves, sizeof(PruneMove));
+            res->moves[res->nmoves++] = r->moves[src->moves + i];
+        }
+        for (i = 0; i < src->nsubs; i++) {
+            Prune_Reserve((void**) &res->subs, res->nsubs, &res->capsubs, sizeof(int));
+            res->subs[res->nsubs++] = r->subs[src->subs + i];
         }
     }
-    printf("\n");
-    for (i=0; i<MG; i++) {
-        if (gids_arr[i] != (Info*) 1) {
-            printf("    GROUPID = %d, SUBLIST =", G[i].gId);
-            s = G[i].gsub;
-            while (s != NULL) {
-                printf(" %d", s->sId);
-                s = s->snext;
-            }
-            printf("\n");
+    free(pos);
+}
+
+// PUBLISH QUEUE
+
+/**
+ * Creates the publish queue
+ * @param capacity Slots (rounded up to a power of 2 of at least 2, 0 for no queue)
+ */
+void Publish_Init(int capacity) {
+    unsigned long i, cap = 2; // A freed slot must not look published
+    memset(&E->PQ, 0, sizeof(E->PQ));
+    if (capacity <= 0) return;
+    while (cap < (unsigned long) capacity) cap *= 2;
+    E->PQ.slots = (PublishSlot*) malloc(cap*sizeof(PublishSlot));
+    E->PQ.mask = cap-1;
+    for (i = 0; i < cap; i++) E->PQ.slots[i].seq = i;
+}
+
+/**
+ * Frees the publish queue (events that were not drained are dropped)
+ */
+void Publish_Free(void) {
+    PublishSlot *s;
+    if (E->PQ.slots == NULL) return;
+    for (; E->PQ.head != E->PQ.tail; E->PQ.head++) {
+        s = &E->PQ.slots[E->PQ.head & E->PQ.mask];
+        if (s->seq == E->PQ.head+1 && s->gids != s->local) free(s->gids);
+    }
+    free(E->PQ.slots);
+    memset(&E->PQ, 0, sizeof(E->PQ));
+}
+
+int Publish_Info(int iTM, int iId, const int *gids_arr, int size_of_gids_arr) {
+    PublishSlot *s;
+    unsigned long pos, seq;
+    int i, n = 0, *gids = NULL;
+    // Checks
+    if (E->PQ.slots == NULL || iTM<0 || iId<0 || size_of_gids_arr<=0) return EXIT_FAILURE;
+    if (size_of_gids_arr > PUBLISH_GIDS+1)
+        gids = (int*) malloc(size_of_gids_arr*sizeof(int));
+    // Claims the slot at the tail: It is free once its seq reaches the
+    // position, it still holds an older event if seq is behind
+    pos = __atomic_load_n(&E->PQ.tail, __ATOMIC_RELAXED);
+    while (1) {
+        s = &E->PQ.slots[pos & E->PQ.mask];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&E->PQ.tail, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((long) (seq - pos) < 0) {
+            free(gids);
+            return EXIT_FAILURE; // Full
+        } else {
+            pos = __atomic_load_n(&E->PQ.tail, __ATOMIC_RELAXED);
         }
     }
+    // Copies the event without its invalid gids
+    s->gids = (gids != NULL) ? gids : s->local;
+    for (i = 0; i < size_of_gids_arr-1; i++)
+        if (gids_arr[i] >= 0) s->gids[n++] = gids_arr[i];
+    s->gids[n++] = -1;
+    s->size = n;
+    s->iTM = iTM;
+    s->iId = iId;
+    // Publishes it to the consumer
+    __atomic_store_n(&s->seq, pos+1, __ATOMIC_RELEASE);
+    return EXIT_SUCCESS;
+}
+
+int Publish_Drain(int max, PublishCallback cb, void *ctx) {
+    PublishSlot *s;
+    int i, n;
+    if (E->PQ.slots == NULL) return 0;
+    // Takes the events published at the head (a slot still being written
+    // ends the batch, it is taken by the next drain)
+    for (n = 0; n < max; n++) {
+        s = &E->PQ.slots[(E->PQ.head+n) & E->PQ.mask];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != E->PQ.head+n+1) break;
+    }
+    if (n == 0) return 0;
+    // Groups may be registered, so the engine is held alone for the batch
+    Engine_Lock(1);
+    Index_Lock();
+    for (i = 0; i < n; i++) {
+        s = &E->PQ.slots[(E->PQ.head+i) & E->PQ.mask];
+        s->claimed = Info_isUnique_iId(s->iId);
+        if (s->claimed) Index_Acquire(s->iId);
+    }
+    Index_Unlock();
+    for (i = 0; i < n; i++) {
+        s = &E->PQ.slots[(E->PQ.head+i) & E->PQ.mask];
+        if (s->claimed) Info_Add(s->iTM, s->iId, s->gids, s->size);
+        if (cb != NULL) cb(s->iTM, s->iId, s->claimed ? EXIT_SUCCESS : EXIT_FAILURE, ctx);
+    }
+    Engine_Unlock();
+    // Hands the slots back to the producers for their next round
+    for (i = 0; i < n; i++) {
+        s = &E->PQ.slots[(E->PQ.head+i) & E->PQ.mask];
+        if (s->gids != s->local) free(s->gids);
+        __atomic_store_n(&s->seq, E->PQ.head+i+E->PQ.mask+1, __ATOMIC_RELEASE);
+    }
+    E->PQ.head += n;
+    return n;
 }
 
+// NOTIFICATIONS
+
 /**
- * Handles printing process after a subscriber registration event
- * @param sTM Sub's tm
+ * Makes the ready list's eventfd readable or resets it (READY_LOCK is held)
+ * @param ready Whether the list has subs
+ */
+static void Ready_Signal(int ready) {
+    uint64_t v = 1;
+    ssize_t n;
+    if (E->RL.fd == -1) return;
+    n = ready ? write(E->RL.fd, &v, sizeof(v)) : read(E->RL.fd, &v, sizeof(v));
+    if (n < 0 && errno != EAGAIN) perror("Signaling the ready list");
+}
+
+/**
+ * Appends a sub to the ready list (READY_LOCK is held)
  * @param sId Sub's id
- * @param gids_arr Sub's groups of interested
- * @param size_of_gids_arr Size of gids_arr
  */
-void Subscriber_Registration_Print(int sTM, int sId, int *gids_arr, int size_of_gids_arr) {
+static void Ready_Push(int sId) {
+    int i, *ids;
+    if (E->RL.len == E->RL.cap) {
+        // Unrolls the ring into a bigger one
+        ids = (int*) malloc((E->RL.cap ? 2*E->RL.cap : 64)*sizeof(int));
+        for (i = 0; i < E->RL.len; i++) ids[i] = E->RL.ids[(E->RL.head+i) % E->RL.cap];
+        free(E->RL.ids);
+        E->RL.ids = ids;
+        E->RL.head = 0;
+        E->RL.cap = E->RL.cap ? 2*E->RL.cap : 64;
+    }
+    E->RL.ids[(E->RL.head+E->RL.len) % E->RL.cap] = sId;
+    if (E->RL.len++ == 0) Ready_Signal(1);
+}
+
+/**
+ * Removes a sub from the ready list (READY_LOCK is held)
+ * @param sId Sub's id
+ */
+static void Ready_Remove(int sId) {
     int i;
-    Sub* s;
-    SubInfo* ptr;
-    printf("S %d %d", sTM, sId);
-    for (i=0; i<MG; i++) {
-        if (SubInfo_Interested(gids_arr, size_of_gids_arr, i))
-            printf(" %d", G[i].gId);
-    }
-    printf(" DONE\n");
-    printf("    SUBSCRIBERLIST = ");
-    for (i=0; i<M; i++) {
-        ptr = HT[i];
-        while (ptr!=NULL) {
-            printf(" %d", ptr->sId);
-            ptr=ptr->snext;
-        }
+    for (i = 0; i < E->RL.len && E->RL.ids[(E->RL.head+i) % E->RL.cap] != sId; i++);
+    if (i == E->RL.len) return;
+    for (E->RL.len--; i < E->RL.len; i++)
+        E->RL.ids[(E->RL.head+i) % E->RL.cap] = E->RL.ids[(E->RL.head+i+1) % E->RL.cap];
+    if (E->RL.len == 0) Ready_Signal(0);
+}
+
+/**
+ * Tells a watched sub it has infos to consume, unless it was told already
+ * Subs with a callback are added to calls, to be called once the engine
+ * is unlocked
+ * @param sub Sub
+ * @param calls Callbacks to make
+ * @param n Number of callbacks in calls
+ * @param cap Capacity of calls
+ */
+static void Watch_Tell(SubInfo *sub, Notice **calls, int *n, int *cap) {
+    if (sub->sready) return;
+    sub->sready = 1;
+    if (sub->snotify == NULL) {
+        // It may still be queued from before it last consumed
+        pthread_mutex_lock(&E->READY_LOCK);
+        if (!sub->squeued) Ready_Push(sub->sId);
+        sub->squeued = 1;
+        pthread_mutex_unlock(&E->READY_LOCK);
+        return;
     }
-    printf("\n");
-    for (i=0; i<MG; i++) {
-        if (gids_arr[i]!=-2 && SubInfo_Interested(gids_arr, size_of_gids_arr, i)) {
-            printf("    GROUPID = %d, SUBLIST =", G[i].gId);
-            s = G[i].gsub;
-            while (s != NULL) {
-                printf(" %d", s->sId);
-                s = s->snext;
-            }
-            printf("\n");
-        }
+    if (*n == *cap) {
+        *cap = (*cap==0) ? 16 : 2*(*cap);
+        *calls = (Notice*) realloc(*calls, (*cap)*sizeof(Notice));
     }
+    (*calls)[*n].cb = sub->snotify;
+    (*calls)[*n].ctx = sub->sctx;
+    (*calls)[*n].sId = sub->sId;
+    (*n)++;
 }
 
 /**
- * Prints group's info tree
- * @param T Info list
+ * Tells the watching subs of the groups the last prune delivered to
+ * Groups nobody watches were never marked, and only a group's watchers
+ * are walked, so subs that don't watch cost nothing
+ * @param calls Set to the callbacks to make (NULL if none)
+ * @return Number of callbacks
  */
-void printGroupInfo(Info *T) {
-    if (T==NULL) return;
-    printGroupInfo(T->ilc);
-    printf(" %d", T->iId);
-    printGroupInfo(T->irc);
+int Watch_Collect(Notice **calls) {
+    int k, i, n = 0, cap = 0;
+    *calls = NULL;
+    for (k = 0; k < E->GN; k++) {
+        if (!E->G[k].gnew) continue;
+        E->G[k].gnew = 0;
+        for (i = 0; i < E->G[k].gwatch; i++)
+            Watch_Tell(E->G[k].gwatchers[i].sub, calls, &n, &cap);
+    }
+    return n;
 }
 
 /**
- * Handles printing process after an info insertion event
- * @param iTM Info tm
- * @param iId Info id
- * @param gids_arr Groups the info is associated with
- * @param size_of_gids_arr Size of gids_arr
+ * Adds a sub to the watchers of one of its groups
+ * @param sub Sub
+ * @param j Index of the group in sub->sgs
  */
-void Insert_Info_Print(int iTM,int iId, const int *gids_arr, int size_of_gids_arr) {
+static void Watch_Add(SubInfo *sub, int j) {
+    Group *g = &E->G[sub->sgs[j].gs];
+    if (g->gwatch == g->gwatchcap) {
+        g->gwatchcap = (g->gwatchcap==0) ? 4 : 2*g->gwatchcap;
+        g->gwatchers = (Watcher*) realloc(g->gwatchers, g->gwatchcap*sizeof(Watcher));
+    }
+    g->gwatchers[g->gwatch].sub = sub;
+    g->gwatchers[g->gwatch].sg = j;
+    sub->sgs[j].widx = g->gwatch++;
+}
+
+/**
+ * Removes a sub from the watchers of one of its groups
+ * The group's last watcher takes its place
+ * @param sub Sub
+ * @param j Index of the group in sub->sgs
+ */
+static void Watch_Remove(SubInfo *sub, int j) {
+    Group *g = &E->G[sub->sgs[j].gs];
+    Watcher *last = &g->gwatchers[--g->gwatch];
+    g->gwatchers[sub->sgs[j].widx] = *last;
+    last->sub->sgs[last->sg].widx = sub->sgs[j].widx;
+    sub->sgs[j].widx = -1;
+}
+
+/**
+ * Makes the callbacks Watch_Collect gathered
+ * @param calls Callbacks (freed)
+ * @param n Number of callbacks
+ */
+void Watch_Fire(Notice *calls, int n) {
     int i;
-    Info* p;
-    printf("I %d %d DONE\n", iTM, iId);
-    for (i=0; i<size_of_gids_arr; i++) {
-        if (gids_arr[i]!=-2) {
-            printf("    GROUPID = %d, INFOLIST =", G[gids_arr[i]].gId);
-            p = G[gids_arr[i]].gr;
-            printGroupInfo(p);
-            printf("\n");
+    for (i = 0; i < n; i++)
+        calls[i].cb(calls[i].sId, calls[i].ctx);
+    free(calls);
+}
+
+/**
+ * Stops watching a sub (the engine is held alone)
+ * @param sub Sub
+ */
+void Watch_Stop(SubInfo *sub) {
+    int i;
+    for (i = 0; i < sub->sgn; i++)
+        Watch_Remove(sub, i);
+    pthread_mutex_lock(&E->READY_LOCK);
+    if (sub->squeued) Ready_Remove(sub->sId);
+    sub->squeued = 0;
+    pthread_mutex_unlock(&E->READY_LOCK);
+    sub->swatch = 0;
+    sub->sready = 0;
+    sub->snotify = NULL;
+    sub->sctx = NULL;
+}
+
+int Subscriber_Watch(int sId, NotifyCallback cb, void *ctx) {
+    Notice *calls = NULL;
+    int i, n = 0, cap = 0;
+    SubInfo *sub;
+    Engine_Lock(1);
+    sub = Hash_LookUp(sId);
+    if (sub == NULL) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
+    if (sub->swatch) Watch_Stop(sub);
+    for (i = 0; i < sub->sgn; i++)
+        Watch_Add(sub, i);
+    sub->swatch = 1;
+    sub->snotify = cb;
+    sub->sctx = ctx;
+    // Infos delivered before it watched are told of at once
+    for (i = 0; i < sub->sgn; i++) {
+        if (E->G[sub->sgs[i].gs].gend > SubGroup_Next(&sub->sgs[i])) {
+            Watch_Tell(sub, &calls, &n, &cap);
+            break;
         }
     }
+    Engine_Unlock();
+    Watch_Fire(calls, n);
+    return EXIT_SUCCESS;
+}
+
+int Subscriber_Unwatch(int sId) {
+    SubInfo *sub;
+    Engine_Lock(1);
+    sub = Hash_LookUp(sId);
+    if (sub == NULL || !sub->swatch) {
+        Engine_Unlock();
+        return EXIT_FAILURE;
+    }
+    Watch_Stop(sub);
+    Engine_Unlock();
+    return EXIT_SUCCESS;
+}
+
+int Ready_Take(int max, int *out) {
+    int n = 0, taken = 0;
+    SubInfo *sub;
+    Engine_Lock(0);
+    pthread_mutex_lock(&E->READY_LOCK);
+    while (n < max && E->RL.len > 0) {
+        sub = Hash_LookUp(E->RL.ids[E->RL.head]);
+        E->RL.head = (E->RL.head+1) % E->RL.cap;
+        E->RL.len--;
+        taken++;
+        sub->squeued = 0;
+        if (__atomic_load_n(&sub->sready, __ATOMIC_RELAXED)) out[n++] = sub->sId;
+    }
+    // Nothing left to wait for
+    if (taken > 0 && E->RL.len == 0) Ready_Signal(0);
+    pthread_mutex_unlock(&E->READY_LOCK);
+    Engine_Unlock();
+    return n;
+}
+
+int Ready_Fd(void) {
+    int fd;
+    pthread_mutex_lock(&E->READY_LOCK);
+    if (E->RL.fd == -1) E->RL.fd = eventfd(E->RL.len > 0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd = E->RL.fd;
+    pthread_mutex_unlock(&E->READY_LOCK);
+    return fd;
 }
+
+/**
+ * Frees the ready list
+ */
+void Ready_Free(void) {
+    free(E->RL.ids);
+    if (E->RL.fd != -1) close(E->RL.fd);
+    E->RL.ids = NULL;
+    E->RL.head = 0;
+    E->RL.len = 0;
+    E->RL.cap = 0;
+    E->RL.fd = -1;
+}
+
 // UTILITY
 
 /**
- * Filters gids_arr array: Invalid values are set to -2
+ * Filters gids_arr array: Invalid values are set to -2 and valid group ids
+ * are replaced by their group slots (new groups are registered)
  * @param gids_arr gids_arr to be filtered
  * @param size_of_gids_arr Size of gids_arr
+ * @return Number of valid groups
  */
-void filterArray(int *gids_arr, int *size_of_gids_arr) {
-    int i, j;
+int filterArray(int *gids_arr, int *size_of_gids_arr) {
+    int i, k, mark, *seen, valid=0;
+    Local *l = NULL;
     *size_of_gids_arr=*size_of_gids_arr-1;
     int n=*size_of_gids_arr;
-    // Checks for duplicates
+    // Marks the groups seen by this call to catch duplicates in one pass
+    // (Concurrent calls can't share the marks in G, each thread has its own)
+    if (E->THREADSAFE) {
+        l = Local_Get();
+        mark = ++l->mark;
+    } else {
+        mark = ++E->GMARK;
+    }
     for (i=0; i<n; i++) {
-        if (gids_arr[i]>=M || gids_arr<0)
-            gids_arr[i]=-2;
-        for (j=i+1; j<n; j++) {
-            if (gids_arr[i]==gids_arr[j]) {
-                gids_arr[j]=-2; // Duplicate number is set to -2: A non-valid Id that marks this cell as "empty"/non-valid
+        if (gids_arr[i]<0) {
+            gids_arr[i]=-2; // Set to -2: A non-valid Id that marks this cell as "empty"/non-valid
+            continue;
+        }
+        k = Group_Register(gids_arr[i]);
+        if (l != NULL) {
+            if (k >= l->markcap) {
+                l->marks = (int*) realloc(l->marks, E->GCAP*sizeof(int));
+                memset(l->marks + l->markcap, 0, (E->GCAP - l->markcap)*sizeof(int));
+                l->markcap = E->GCAP;
             }
+            seen = &l->marks[k];
+        } else {
+            seen = &E->G[k].gmark;
         }
+        if (*seen==mark) {
+            gids_arr[i]=-2; // Duplicate
+            continue;
+        }
+        *seen=mark;
+        gids_arr[i]=k;
+        valid++;
+    }
+    return valid;
+}
+
+// GROUPS
+
+/**
+ * Returns the home slot of a group id in the registry
+ * @param gid Group id
+ * @param cap Capacity of the registry (power of 2)
+ * @return Registry slot
+ */
+static int Registry_Slot(int gid, int cap) {
+    unsigned int h = (unsigned int) gid * 2654435769u;
+    return (int) ((h ^ (h>>16)) & (unsigned int) (cap-1));
+}
+
+/**
+ * Doubles the capacity of the group registry
+ */
+static void Registry_Grow(void) {
+    int *keys = E->REG.keys, *slots = E->REG.slots, cap = E->REG.cap, i, j;
+    E->REG.cap = (cap==0)?64:cap*2;
+    E->REG.keys = (int*) malloc(E->REG.cap*sizeof(int));
+    E->REG.slots = (int*) malloc(E->REG.cap*sizeof(int));
+    for (i=0; i<E->REG.cap; i++) E->REG.keys[i] = -1;
+    for (i=0; i<cap; i++) {
+        if (keys[i] == -1) continue;
+        j = Registry_Slot(keys[i], E->REG.cap);
+        while (E->REG.keys[j] != -1) j = (j+1) & (E->REG.cap-1);
+        E->REG.keys[j] = keys[i];
+        E->REG.slots[j] = slots[i];
+    }
+    free(keys);
+    free(slots);
+}
+
+/**
+ * Returns the slot of a group in G
+ * @param gid Group id
+ * @return Slot or -1 if the group is not registered
+ */
+int Group_Slot(int gid) {
+    int i;
+    if (E->REG.cap == 0) return -1;
+    i = Registry_Slot(gid, E->REG.cap);
+    while (E->REG.keys[i] != -1) {
+        if (E->REG.keys[i] == gid) return E->REG.slots[i];
+        i = (i+1) & (E->REG.cap-1);
+    }
+    return -1;
+}
+
+/**
+ * Returns the slot of a group in G, registering the group if needed
+ * @param gid Group id (non negative)
+ * @return Slot
+ */
+int Group_Register(int gid) {
+    int i, k = Group_Slot(gid);
+    if (k != -1) return k;
+    // Adds it to the registry
+    if ((E->REG.size+1)*4 > E->REG.cap*3) Registry_Grow(); // Keeps load factor under 0.75
+    i = Registry_Slot(gid, E->REG.cap);
+    while (E->REG.keys[i] != -1) i = (i+1) & (E->REG.cap-1);
+    E->REG.keys[i] = gid;
+    E->REG.slots[i] = E->GN;
+    E->REG.size++;
+    // Adds it to G
+    if (E->GN == E->GCAP) {
+        E->GCAP = (E->GCAP==0)?MG:E->GCAP*2;
+        E->G = (Group*) realloc(E->G, E->GCAP*sizeof(Group));
+    }
+    k = E->GN++;
+    E->G[k].gId=gid;
+    E->G[k].gmark=0;
+    E->G[k].gr=NULL;
+    E->G[k].gsub=NULL;
+    E->G[k].gheap=NULL;
+    E->G[k].gheapsize=0;
+    E->G[k].gheapcap=0;
+    E->G[k].glock=NULL;
+    E->G[k].gwatchers=NULL;
+    E->G[k].gwatch=0;
+    E->G[k].gwatchcap=0;
+    E->G[k].gnew=0;
+    if (E->THREADSAFE) {
+        // Kept out of G, which moves as it grows
+        E->G[k].glock=(pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
+        pthread_mutex_init(E->G[k].glock, NULL);
+    }
+    Log_Init(&E->G[k]);
+    return k;
+}
+
+/**
+ * Frees the group registry
+ */
+void Registry_Free(void) {
+    free(E->REG.keys);
+    free(E->REG.slots);
+    E->REG.keys = NULL;
+    E->REG.slots = NULL;
+    E->REG.cap = 0;
+    E->REG.size = 0;
+}
+
+/**
+ * Creates a group list for an info, sorted by gid
+ * @param gids_arr Filtered slots of the groups
+ * @param size_of_gids_arr Size of gids_arr
+ * @param n Number of valid groups in gids_arr
+ * @return Group list, owned by the caller (one reference)
+ */
+GroupSet *GroupSet_New(const int *gids_arr, int size_of_gids_arr, int n) {
+    GroupSet *set = (GroupSet*) Mem_AllocSize(sizeof(GroupSet) + n*sizeof(int));
+    int i, j, gid;
+    set->refs = 1;
+    set->n = 0;
+    for (i=0; i<size_of_gids_arr; i++) {
+        if (gids_arr[i]==-2) continue;
+        gid = E->G[gids_arr[i]].gId;
+        for (j=set->n++; j>0 && set->gids[j-1]>gid; j--)
+            set->gids[j]=set->gids[j-1];
+        set->gids[j]=gid;
     }
+    return set;
+}
+
+/**
+ * Drops a reference to a group list, freeing it when none are left
+ * @param set Group list
+ */
+void GroupSet_Release(GroupSet *set) {
+    int refs;
+    // Copies of an info in different groups may be pruned at once
+    if (E->LEAF_LOCKING) pthread_mutex_lock(&E->GROUPSET_LOCK);
+    refs = --set->refs;
+    if (E->LEAF_LOCKING) pthread_mutex_unlock(&E->GROUPSET_LOCK);
+    if (refs == 0) Mem_FreeSize(set, sizeof(GroupSet) + set->n*sizeof(int));
 }
 
 /**
  * Returns a random number between min and max (including them)
  * @param min Low border
- * @param max High border
+ * @param max High border (min when it is below min, e.g. for p=1)
  * @return Random number
  */
 int random(int min, int max) {
-    srand(time(0));
-    int num = (rand() % (min - max + 1)) + min;
+    int num;
+    if (max < min) return min;
+    num = min + rand_r(&E->SEED) % (max - min + 1);
     return num;
 }
 
+#ifndef OPEN_ADDRESSING
 /**
  * Returns the index of Hash Table for number x based on hash function
+ * @param t Hash Table
  * @param x X's index requested
  * @return Hash Table's index for X
  */
-int Universal_Hash_Function(int x) {
-    int k = ((A*x+B) % P) % M;
+int Universal_Hash_Function(HashTable *t, int x) {
+    int k = (int) ((((long long) t->a*x + t->b) % t->p) % t->m);
     return k;
 }
-
-/**
- * Frees consumption tree
- * @param T Consumption tree
- */
-void freeConsumption(TreeInfo *T) {
-    if (T==NULL || T==(TreeInfo*) 1) return;
-    freeConsumption(T->tlc);
-    freeConsumption(T->trc);
-    if (T==NULL || T==(TreeInfo*) 1) free(T); // Used to avoid some unexpected "duplicated frees"
-}
+#endif /* OPEN_ADDRESSING */
 
 /**
  * Free group's sub list
@@ -1088,17 +3783,28 @@ void freeSub(Sub *T) {
     while (p!=NULL) {
         del = p;
         p=p->snext;
-        free(del);
+        Mem_Free(&E->PS.sub, del);
     }
 }
 
 /**
  * Free group's info list
+ * Rotates left children up until the node has none, so no stack is needed
  * @param T Group's info list
  */
 void freeInfo(Info *T) {
-    if (T==NULL) return;
-    freeInfo(T->ilc);
-    freeInfo(T->irc);
-    free(T);
+    Info *l;
+    while (T!=NULL) {
+        if (T->ilc!=NULL) {
+            l=T->ilc;
+            T->ilc=l->irc;
+            l->irc=T;
+            T=l;
+        } else {
+            l=T->irc;
+            GroupSet_Release(T->igp);
+            Mem_Free(&E->PS.info, T);
+            T=l;
+        }
+    }
 }
\ No newline at end of file
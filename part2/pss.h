@@ -15,12 +15,35 @@
 
 #ifndef pss_h
 #define pss_h
-#define MG 64
+#include <pthread.h>
+#define MG 64 // Groups 0..MG-1 registered by initialize(), others on first use
+#define LOG_SEGMENT 64
+#define POOL_BLOCK 256 // Objects per slab of a node pool
+#define POOL_CLASSES 10 // Size classes for variable sized nodes (16 bytes to 8KB)
+#define OUTPUT_TEXT 0 // Output formats
+#define OUTPUT_JSON 1
+#define OUTPUT_BINARY 2
+#define OUTPUT_NONE 3
+#define OUTPUT_FLUSH 65536 // Buffered output is written once it grows past this
+#define OUTPUT_DEPTH 8 // Maximum nesting of structured output
+#define PUBLISH_GIDS 15 // Gids a publish queue slot holds inline (more are allocated)
+#define PUBLISH_LINE 64 // Producer and consumer positions are kept this far apart
 
+/* Uncomment the following line to use the open addressing subscriber
+ * directory instead of the chained hash table */
+/* #define OPEN_ADDRESSING */
+
+struct GroupSet {
+    int refs;
+    int n;
+    int gids[];
+};
+typedef struct GroupSet GroupSet;
 struct Info {
     int iId;
     int itm;
-    int igp[MG];
+    struct GroupSet *igp;
+    int ih;
     struct Info *ilc;
     struct Info *irc;
     struct Info *ip;
@@ -31,30 +54,313 @@ struct Subscription {
     struct Subscription *snext;
 };
 typedef struct Subscription Sub;
+struct TimeEntry {
+    int tm;
+    int id;
+};
+typedef struct TimeEntry TimeEntry;
+struct Delivery {
+    int gId;
+    int iId;
+    int itm;
+};
+typedef struct Delivery Delivery;
+struct MergeHead {
+    struct TimeEntry e;
+    int sg; // Index in the sub's sgs
+};
+typedef struct MergeHead MergeHead;
+struct Merge {
+    struct MergeHead *heap;
+    int n;
+    int cap;
+};
+typedef struct Merge Merge;
+struct LogSegment {
+    long base;
+    int count;
+    int refs;
+    struct TimeEntry items[LOG_SEGMENT];
+    struct LogSegment *next;
+    struct LogSegment *prev;
+};
+typedef struct LogSegment LogSegment;
 struct Group {
     int gId;
+    int gmark;
     struct Subscription *gsub;
     struct Info *gr;
+    struct TimeEntry *gheap;
+    int gheapsize;
+    int gheapcap;
+    struct LogSegment *glog;
+    struct LogSegment *gtail;
+    long gend;
+    pthread_mutex_t *glock; // NULL unless the engine is thread safe
+    struct Watcher *gwatchers; // Subs watching it (see Subscriber_Watch)
+    int gwatch;
+    int gwatchcap;
+    int gnew;               // Delivered to by the prune in progress (set only if watched)
 };
 typedef struct Group Group;
+struct SubGroup {
+    int gId;
+    int gs;
+    long tgp;
+    long sgp;
+    struct LogSegment *spin;
+    int widx;               // Place in the group's watchers (-1: not watching)
+};
+typedef struct SubGroup SubGroup;
+/* A watching sub, and which of its groups the list is of */
+struct Watcher {
+    struct SubInfo *sub;
+    int sg;                 // Index in sub->sgs
+};
+typedef struct Watcher Watcher;
+/* Told that a subscriber has new infos to consume (see Subscriber_Watch) */
+typedef void (*NotifyCallback)(int sId, void *ctx);
 struct SubInfo {
     int sId;
     int stm;
-    struct TreeInfo *tgp[MG];
-    struct TreeInfo *sgp[MG];
+    int sgn;
+    struct SubGroup *sgs;
     struct SubInfo *snext;
+    int swatch;             // Prune tells it of new infos
+    int sready;             // Told, and hasn't consumed everything since
+    int squeued;            // On the ready list (READY_LOCK)
+    NotifyCallback snotify; // NULL: Put on the ready list instead
+    void *sctx;
 };
 typedef struct SubInfo SubInfo;
-struct TreeInfo {
-    int tId;
-    int ttm;
-    struct TreeInfo *tlc;
-    struct TreeInfo *trc;
-    struct TreeInfo *tp;
-    struct TreeInfo *next;
-    struct TreeInfo *prev;
+#ifdef OPEN_ADDRESSING
+struct HashTable {
+    int *keys;
+    unsigned char *dist;
+    struct SubInfo **subs;
+    int m;
+    int used;
+};
+#else /* OPEN_ADDRESSING */
+struct HashTable {
+    struct SubInfo **ht;
+    int m;
+    int used;
+    int a;
+    int b;
+    int p;
+};
+#endif /* OPEN_ADDRESSING */
+typedef struct HashTable HashTable;
+struct HashIter {
+    int t;
+    int i;
+    struct SubInfo *p;
+};
+typedef struct HashIter HashIter;
+struct IdSlot {
+    int id;
+    int refs;
+};
+typedef struct IdSlot IdSlot;
+struct IdIndex {
+    struct IdSlot *slots;
+    int cap;
+    int size;
+};
+typedef struct IdIndex IdIndex;
+struct Registry {
+    int *keys;
+    int *slots;
+    int cap;
+    int size;
 };
-typedef struct TreeInfo TreeInfo;
+typedef struct Registry Registry;
+struct PoolBlock {
+    struct PoolBlock *next;
+    void *pad; // Keeps the objects that follow 16 byte aligned
+};
+typedef struct PoolBlock PoolBlock;
+struct Pool {
+    size_t size;
+    void *free;
+    struct PoolBlock *blocks;
+};
+typedef struct Pool Pool;
+struct PoolLarge {
+    struct PoolLarge *next;
+    struct PoolLarge *prev;
+};
+typedef struct PoolLarge PoolLarge;
+struct Pools {
+    int enabled;
+    struct Pool info;
+    struct Pool sub;
+    struct Pool subinfo;
+    struct Pool segment;
+    struct Pool sized[POOL_CLASSES];
+    struct PoolLarge *large;
+};
+typedef struct Pools Pools;
+/* Receives rendered output instead of stdout, a whole event at a time */
+typedef void (*OutputSink)(const char *buf, size_t len, void *ctx);
+struct Output {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t block;
+    int format;
+    int depth;
+    char kind[OUTPUT_DEPTH];
+    int first[OUTPUT_DEPTH];
+    OutputSink sink;        // NULL for stdout
+    void *ctx;
+};
+typedef struct Output Output;
+struct Local {
+    struct Output out;
+    struct Merge mh;
+    int *marks;             // Groups seen by filterArray, by slot
+    int markcap;
+    int mark;               // Mark of the last filterArray
+    struct Engine *engine;
+    struct Local *prev;     // In the engine's list of them
+    struct Local *next;
+};
+typedef struct Local Local;
+struct PruneMove {
+    int iId;
+    int itm;
+    long off; // Offset in the group's log (-1 if the group had no subs)
+};
+typedef struct PruneMove PruneMove;
+struct PruneGroup {
+    int gId;
+    int moves;  // First of its moves in the result
+    int nmoves;
+    int subs;   // First of its subs in the result
+    int nsubs;
+    long gend;  // New end of the group's log
+};
+typedef struct PruneGroup PruneGroup;
+struct PruneResult {
+    struct PruneGroup *groups;
+    int ngroups;
+    int capgroups;
+    struct PruneMove *moves;
+    int nmoves;
+    int capmoves;
+    int *subs;
+    int nsubs;
+    int capsubs;
+};
+typedef struct PruneResult PruneResult;
+struct PruneWorkers {
+    pthread_t *threads;     // Helpers (the thread that prunes is worker 0)
+    int n;                  // Workers
+    struct PruneResult *res; // One per worker
+    int *owner;             // Worker whose result holds each group (-1 for none)
+    int ownercap;
+    int tm;                 // Prune in progress
+    int record;             // Whether results are recorded
+    int next;               // Next group to be handed out
+    int started;            // Helpers that took their worker number
+    int gen;                // Bumped for every parallel prune
+    int busy;               // Helpers still on the current prune
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+};
+typedef struct PruneWorkers PruneWorkers;
+struct PublishSlot {
+    unsigned long seq;      // Position it is free for (pos) or published at (pos+1)
+    int iTM;
+    int iId;
+    int size;               // Size of gids including -1
+    int claimed;            // Id was unique when the batch was taken
+    int *gids;              // local or allocated
+    int local[PUBLISH_GIDS+1];
+};
+typedef struct PublishSlot PublishSlot;
+struct PublishQueue {
+    PublishSlot *slots;
+    unsigned long mask;     // Capacity-1 (power of 2)
+    unsigned long tail;     // Next position for producers
+    char pad[PUBLISH_LINE];
+    unsigned long head;     // Next position for the consumer
+};
+typedef struct PublishQueue PublishQueue;
+/* Told the result of a published info's insert (0, or 1 for an id that
+ * was not unique), right after the insert's output */
+typedef void (*PublishCallback)(int iTM, int iId, int status, void *ctx);
+struct ReadyList {
+    int *ids;               // Ring of the ready subs' ids, oldest first
+    int head;
+    int len;
+    int cap;
+    int fd;                 // eventfd readable while len > 0 (-1 until asked for)
+};
+typedef struct ReadyList ReadyList;
+struct Notice {
+    NotifyCallback cb;
+    void *ctx;
+    int sId;
+};
+typedef struct Notice Notice;
+/* The state of an engine. Every function acts on the calling thread's
+ * engine (see Engine_Use), which starts as a default one */
+struct Engine {
+    struct Group *G;        // Groups by slot
+    int GN;
+    int GCAP;
+    int GMARK;              // Mark of the last filterArray (single threaded)
+    struct Registry REG;    // Slots of the group ids
+    struct HashTable HT[2]; // Subscriber directory (HT[1] while rehashing)
+    int rehashIdx;          // Next chain of HT[0] to move (-1 if not rehashing)
+    struct IdIndex IDX;
+    struct Pools PS;
+    struct Output OUT;
+    struct PruneResult PR;
+    struct Merge MH;
+    int PRUNE_DUMP;
+    int CONSUME_MERGE;
+    int FAST_EXIT;
+    int THREADSAFE;
+    int LEAF_LOCKING;       // Leaf locks are taken (thread safe or pruning in parallel)
+    pthread_rwlock_t ENGINE_LOCK;
+    pthread_mutex_t INDEX_LOCK;
+    pthread_mutex_t POOLS_LOCK;
+    pthread_mutex_t OUTPUT_LOCK;
+    pthread_mutex_t GROUPSET_LOCK;
+    pthread_mutex_t READY_LOCK;
+    pthread_key_t LOCAL_KEY; // Threads' state (thread safe only)
+    struct Local *LOCALS;   // All of it, freed by free_all (OUTPUT_LOCK)
+    struct PruneWorkers PW;
+    struct PublishQueue PQ;
+    struct ReadyList RL;
+    int P;
+    int M;
+    int A;
+    int B;
+    unsigned int SEED;      // Of random()
+};
+typedef struct Engine Engine;
+/* Receives a run of consumed infos of a group, oldest first. The run is
+ * contiguous in memory and only valid during the call */
+typedef void (*ConsumeCallback)(int gId, const TimeEntry *items, int n, void *ctx);
+struct Config {
+    int groups;
+    int pools;
+    int output;
+    int prune_dump;
+    int consume_merge; // Consume() prints the sub's groups as one stream
+    int fast_exit; // free_all() only writes pending output (the process is about to exit)
+    int threadsafe; // Events may be called from several threads at once
+    int prune_threads; // Groups are pruned by this many threads (0 or 1: by the caller alone)
+    int publish; // Capacity of the publish queue (0: no queue)
+};
+typedef struct Config Config;
 
 /**
  * @brief Optional function to initialize data structures that
@@ -68,6 +374,38 @@ typedef struct TreeInfo TreeInfo;
  */
 int initialize(int m, int p);
 
+/**
+ * @brief Initialize data structures with a custom configuration
+ *
+ * @param m Size of hash table
+ * @param p Prime number for the universal hash function
+ * @param cfg Configuration (groups: number of groups 0..groups-1 registered
+ *            upfront, any other group id is registered on first use;
+ *            pools: non zero to allocate nodes from slab pools;
+ *            output: OUTPUT_TEXT for the course's text, OUTPUT_JSON for
+ *            an object per event and line, OUTPUT_BINARY for an event
+ *            byte, a block length and tagged varints per event, or
+ *            OUTPUT_NONE to print nothing;
+ *            prune_dump: non zero to print the whole system after every
+ *            prune instead of what the prune changed;
+ *            consume_merge: non zero for Consume() to print a single list
+ *            of the subscriber's groups merged by timestamp, every info
+ *            once;
+ *            fast_exit: non zero for free_all() to only write pending
+ *            output and leave the memory to the process' exit;
+ *            threadsafe: non zero to let several threads call into the
+ *            engine at once, events on different groups and subs run in
+ *            parallel;
+ *            prune_threads: number of threads a prune splits the groups
+ *            among, the calling one included (0 or 1: the caller alone);
+ *            publish: capacity of the queue of Publish_Info (rounded up to
+ *            a power of 2, 0: no queue))
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+int initialize_config(int m, int p, const Config *cfg);
+
 /**
  * @brief Free resources
  *
@@ -76,6 +414,41 @@ int initialize(int m, int p);
  */
 int free_all(void);
 
+/**
+ * @brief Create an engine of its own, besides the default one
+ *
+ * @param m Size of hash table
+ * @param p Prime number for the universal hash function
+ * @param cfg Configuration (see initialize_config)
+ *
+ * @return The engine, to be selected with Engine_Use
+ *         NULL on failure
+ */
+Engine *Engine_New(int m, int p, const Config *cfg);
+
+/**
+ * @brief Select the engine the calling thread's following calls act on
+ *
+ * Threads start on the default engine, the one initialize() sets up.
+ * Any thread that calls into an engine created with Engine_New, to
+ * publish to it for instance, selects it first.
+ *
+ * @param e Engine (NULL for the default one)
+ */
+void Engine_Use(Engine *e);
+
+/**
+ * @brief Free an engine created with Engine_New
+ *
+ * The calling thread goes back to the default engine if it was using it.
+ *
+ * @param e Engine
+ *
+ * @return 0 on success
+ *         1 on failure
+ */
+int Engine_Free(Engine *e);
+
 /**
  * @brief Insert info
  *
@@ -109,6 +482,26 @@ int Subscriber_Registration(int sTM,int sId,int* gids_arr,int size_of_gids_arr);
  */
 int Prune(int tm);
 
+/**
+ * @brief Prune Information and report only what changed
+ *
+ * @param tm Information timestamp of arrival
+ * @param res Result (zero initialized before its first use, reused
+ *            across calls): for every group that had expired infos, the
+ *            infos moved to its log, the subs they were delivered to and
+ *            the new end of its log
+ * @return 0 on success
+ *          1 on failure
+ */
+int Prune_Delta(int tm, PruneResult *res);
+
+/**
+ * @brief Free a prune result
+ *
+ * @param res Result
+ */
+void PruneResult_Free(PruneResult *res);
+
 /**
  * @brief Consume Information for subscriber
  *
@@ -118,6 +511,136 @@ int Prune(int tm);
  */
 int Consume(int sId);
 
+/**
+ * @brief Consume Information for subscriber without printing it
+ *
+ * @param sId Subscriber identifier
+ * @param cb Called with every run of newly consumed infos, group by group
+ *           (with the group locked in a thread safe engine, so it must not
+ *           call back into the engine)
+ * @param ctx Passed to cb
+ * @return 0 on success
+ *          1 on failure
+ */
+int Consume_Each(int sId, ConsumeCallback cb, void *ctx);
+
+/**
+ * @brief Count the infos a subscriber has not consumed yet
+ *
+ * @param sId Subscriber identifier
+ * @param gId Group identifier (-1 for all of the subscriber's groups)
+ * @return Number of pending infos
+ *         -1 on failure
+ */
+long Consume_Pending(int sId, int gId);
+
+/**
+ * @brief Consume up to a number of infos into a caller's array
+ *
+ * Infos of all the subscriber's groups are merged in timestamp order.
+ * An info published to several of them is returned once, with the
+ * smallest of their gIds. The rest stay pending for the next call.
+ *
+ * @param sId Subscriber identifier
+ * @param max Capacity of out
+ * @param out Filled with the consumed infos
+ * @return Number of infos written to out
+ *         -1 on failure
+ */
+int Consume_Batch(int sId, int max, Delivery *out);
+
+/**
+ * @brief Have a subscriber told when it gets new infos, so it doesn't poll
+ *
+ * A Prune that delivers to a watched subscriber with nothing pending
+ * either calls cb, once the engine is unlocked, or puts the subscriber
+ * on the ready list (see Ready_Take). The subscriber is told once until
+ * it consumes everything: with Consume, Consume_Each or a Consume_Batch
+ * that returns fewer than max infos. It is told at once if infos are
+ * pending already. Watching again replaces the callback.
+ *
+ * @param sId Subscriber identifier
+ * @param cb Callback (NULL for the ready list)
+ * @param ctx Passed to cb
+ * @return 0 on success
+ *          1 on failure
+ */
+int Subscriber_Watch(int sId, NotifyCallback cb, void *ctx);
+
+/**
+ * @brief Stop telling a subscriber of new infos
+ *
+ * @param sId Subscriber identifier
+ * @return 0 on success
+ *          1 on failure
+ */
+int Subscriber_Unwatch(int sId);
+
+/**
+ * @brief Take subscribers off the ready list, oldest first
+ *
+ * Subscribers that consumed everything since they were put on the list
+ * are dropped from it.
+ *
+ * @param max Capacity of out
+ * @param out Filled with the subscribers' identifiers
+ * @return Number of subscribers written to out
+ */
+int Ready_Take(int max, int *out);
+
+/**
+ * @brief An eventfd that is readable while the ready list is not empty
+ *
+ * It can be waited on with poll or epoll. Ready_Take resets it when it
+ * empties the list.
+ *
+ * @return The descriptor (owned by the engine)
+ *         -1 on failure
+ */
+int Ready_Fd(void);
+
+/**
+ * @brief Send the output of the following events to a sink instead of stdout
+ *
+ * Output pending for stdout is written first. Each event's output is
+ * handed to the sink as soon as the event is over.
+ *
+ * @param sink Sink (NULL for stdout)
+ * @param ctx Passed to the sink
+ */
+void Output_Sink(OutputSink sink, void *ctx);
+
+/**
+ * @brief Publish an info to be inserted by the engine thread
+ *
+ * Lock free, any number of threads may publish at once. The event is
+ * checked and copied, it is inserted by a later Publish_Drain().
+ *
+ * @param iTM Timestamp of arrival
+ * @param iId Identifier of information
+ * @param gids_arr Pointer to array containing the gids of the Event.
+ * @param size_of_gids_arr Size of gids_arr including -1
+ * @return 0 on success
+ *          1 on failure (invalid event, no queue or queue full)
+ */
+int Publish_Info(int iTM, int iId, const int *gids_arr, int size_of_gids_arr);
+
+/**
+ * @brief Insert published infos, in the order they were published
+ *
+ * Only one thread may drain at a time. The whole batch is inserted under
+ * one engine lock, and its ids are checked and claimed in one pass.
+ * Infos whose id is not unique are dropped. The callback is told each
+ * result in publish order, with the engine still locked, so it must not
+ * call back into the engine.
+ *
+ * @param max Most events to take
+ * @param cb Told each insert's result (may be NULL)
+ * @param ctx Passed to cb
+ * @return Number of events taken (0 when none were published)
+ */
+int Publish_Drain(int max, PublishCallback cb, void *ctx);
+
 /**
  * @brief Delete subscriber
  *
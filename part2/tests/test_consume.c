@@ -0,0 +1,186 @@
+/***************************************************************
+ *
+ * file: test_consume.c
+ *
+ * @brief   Test of consuming a sub's groups as one stream.
+ * Consume_Batch merges the groups of a sub by timestamp, hands an
+ * info published to several of them once with its smallest gid, stops
+ * at max and goes on from there on the next call, new infos included.
+ * With consume_merge, Consume() prints the same stream.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pss.h"
+
+#define INFOS 400 // Spans a few log segments of each group
+#define BATCH 7
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+/* What sub 1 (groups 2, 5 and 9) should be handed, oldest first */
+static Delivery expected[INFOS];
+static int nexpected;
+static long copies; // Pending for sub 1, counted per group
+static long copies2; // Pending for sub 2 (group 2)
+
+static char text[1 << 16];
+static size_t textlen;
+
+static unsigned int next(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static void capture(const char *buf, size_t len, void *ctx) {
+    (void) ctx;
+    if (textlen + len < sizeof(text)) {
+        memcpy(text + textlen, buf, len);
+        textlen += len;
+        text[textlen] = '\0';
+    }
+}
+
+/* Publishes infos from..to-1 to one or several groups, and prunes them */
+static int publish(int from, int to, unsigned int *seed) {
+    static const int single[4] = { 2, 5, 9, 3 }; // Sub 1 isn't in 3
+    int gids[5], i, k, n, gId;
+
+    for (i = from; i < to; i++) {
+        switch (next(seed) % 6) {
+        case 0:
+            gids[0] = 9;
+            gids[1] = 5;
+            n = 2;
+            break;
+        case 1:
+            gids[0] = 9;
+            gids[1] = 3;
+            gids[2] = 2;
+            gids[3] = 5;
+            n = 4;
+            break;
+        default:
+            gids[0] = single[next(seed) % 4];
+            n = 1;
+        }
+        gids[n] = -1;
+        gId = MG;
+        for (k = 0; k < n; k++) {
+            if (gids[k] != 3) {
+                copies++;
+                gId = gids[k] < gId ? gids[k] : gId;
+            }
+            copies2 += gids[k] == 2;
+        }
+        if (gId != MG) {
+            expected[nexpected].gId = gId;
+            expected[nexpected].iId = 100 + i;
+            expected[nexpected].itm = 10 + 2 * i;
+            nexpected++;
+        }
+        if (Insert_Info(10 + 2 * i, 100 + i, gids, n + 1) != 0) {
+            return 1;
+        }
+    }
+    return Prune(10 + 2 * to);
+}
+
+/* Takes batches until one comes short, checking them against expected */
+static int batches(int *taken, int limit) {
+    Delivery out[BATCH + 1]; // One past max, that must stay untouched
+    int i, n;
+
+    do {
+        out[BATCH].iId = -1;
+        n = Consume_Batch(1, BATCH, out);
+        CHECK(n >= 0 && *taken + n <= nexpected, "batch at %d got %d\n", *taken, n);
+        CHECK(out[BATCH].iId == -1, "batch at %d wrote past max\n", *taken);
+        for (i = 0; i < n; i++, (*taken)++) {
+            CHECK(out[i].gId == expected[*taken].gId && out[i].iId == expected[*taken].iId &&
+                  out[i].itm == expected[*taken].itm, "got %d %d (group %d) for %d %d (group %d)\n",
+                  out[i].itm, out[i].iId, out[i].gId, expected[*taken].itm,
+                  expected[*taken].iId, expected[*taken].gId);
+        }
+    } while (n == BATCH && *taken < limit);
+    return EXIT_SUCCESS;
+}
+
+static int run(int merge) {
+    Config cfg = { 0 };
+    Delivery out[BATCH];
+    unsigned int seed = 3;
+    int gids[4] = { 5, 2, 9, -1 };
+    int taken = 0, id;
+    char *p, *end;
+
+    nexpected = 0;
+    copies = copies2 = 0;
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = merge ? OUTPUT_TEXT : OUTPUT_NONE;
+    cfg.consume_merge = merge;
+    CHECK(initialize_config(11, 101, &cfg) == 0, "initialize_config failed\n");
+    Output_Sink(capture, NULL);
+    CHECK(Subscriber_Registration(0, 1, gids, 4) == 0, "registration failed\n");
+    gids[0] = 2;
+    gids[1] = -1;
+    CHECK(Subscriber_Registration(0, 2, gids, 2) == 0, "registration failed\n");
+
+    /* Bad calls take nothing */
+    CHECK(publish(0, INFOS / 2, &seed) == 0, "publish failed\n");
+    CHECK(Consume_Pending(1, -1) == copies, "%ld pending, %ld published\n",
+          Consume_Pending(1, -1), copies);
+    CHECK(Consume_Batch(99, BATCH, out) == -1, "unknown sub consumed\n");
+    CHECK(Consume_Batch(1, -1, out) == -1, "negative max accepted\n");
+    CHECK(Consume_Batch(1, BATCH, NULL) == -1, "NULL out accepted\n");
+    CHECK(Consume_Batch(1, 0, NULL) == 0, "empty batch failed\n");
+    CHECK(Consume_Pending(1, -1) == copies, "bad calls consumed\n");
+
+    /* A few batches, then the rest with what was published since */
+    CHECK(batches(&taken, 3 * BATCH) == EXIT_SUCCESS, "first batches failed\n");
+    CHECK(taken == 3 * BATCH && Consume_Pending(1, -1) > 0, "%d taken\n", taken);
+    CHECK(publish(INFOS / 2, INFOS, &seed) == 0, "publish failed\n");
+    if (!merge) {
+        CHECK(batches(&taken, nexpected) == EXIT_SUCCESS, "batches failed\n");
+    } else {
+        textlen = 0;
+        CHECK(Consume(1) == 0, "Consume failed\n");
+        p = strstr(text, "TREELIST =");
+        CHECK(p != NULL, "no TREELIST in: %s\n", text);
+        for (p += 10; (id = (int) strtol(p, &end, 10)), end != p; p = end, taken++) {
+            CHECK(taken < nexpected && id == expected[taken].iId, "printed %d for %d\n", id,
+                  taken < nexpected ? expected[taken].iId : -1);
+        }
+    }
+    CHECK(taken == nexpected, "%d of %d handed\n", taken, nexpected);
+    CHECK(Consume_Pending(1, -1) == 0 && Consume_Batch(1, BATCH, out) == 0,
+          "infos left after all were taken\n");
+    CHECK(Consume_Pending(2, -1) == copies2, "sub 2 has %ld pending of %ld\n",
+          Consume_Pending(2, -1), copies2);
+    printf("consume_merge=%d: %d infos in %ld group copies\n", merge, nexpected, copies);
+
+    Output_Sink(NULL, NULL);
+    CHECK(free_all() == 0, "free_all failed\n");
+    return EXIT_SUCCESS;
+}
+
+int main(void) {
+    if (run(0) != EXIT_SUCCESS || run(1) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/***************************************************************
+ *
+ * file: test_hash.c
+ *
+ * @brief   Test of the subscriber directory with millions of sIds.
+ * Registers, looks up, deletes and registers again 4M scattered ids
+ * while the table grows from 11 chains, and reports the slowest
+ * registration (incremental rehashing keeps it short).
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pss.h"
+
+#define SUBS 4000000
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Distinct ids in a scattered order (odd multiplier modulo 2^31) */
+static int sub_id(int i) {
+    return (int) (((unsigned int) i * 2654435761u) & 0x7fffffff);
+}
+
+/* Registers a subscriber with no groups, so only the directory is timed */
+static int registration(int i, double *worst) {
+    int gids[1] = { -1 };
+    double t = now();
+    int ret = Subscriber_Registration(i, sub_id(i), gids, 1);
+    t = now() - t;
+    if (t > *worst) {
+        *worst = t;
+    }
+    return ret;
+}
+
+int main(void) {
+    Config cfg = { 0 };
+    int gids[3] = { 3, 5, -1 };
+    int info[2] = { 5, -1 };
+    double t, worst = 0;
+    int i;
+
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_NONE;
+    CHECK(initialize_config(11, 101, &cfg) == 0, "initialize_config failed\n");
+
+    t = now();
+    for (i = 0; i < SUBS; i++) {
+        CHECK(registration(i, &worst) == 0, "registration of %d failed\n", sub_id(i));
+    }
+    printf("registered %d subs in %.2fs, slowest %.1fus\n", SUBS, now() - t, worst * 1e6);
+    for (i = 0; i < SUBS; i += 7) {
+        CHECK(registration(i, &worst) == 1, "%d registered twice\n", sub_id(i));
+    }
+    for (i = 0; i < SUBS; i++) {
+        CHECK(Consume_Pending(sub_id(i), -1) == 0, "%d not found\n", sub_id(i));
+    }
+
+    t = now();
+    for (i = 0; i < SUBS; i += 2) {
+        CHECK(Delete_Subscriber(sub_id(i)) == 0, "delete of %d failed\n", sub_id(i));
+    }
+    printf("deleted %d subs in %.2fs\n", SUBS / 2, now() - t);
+    for (i = 0; i < SUBS; i++) {
+        CHECK(Consume_Pending(sub_id(i), -1) == (i % 2 ? 0 : -1), "%d %s\n", sub_id(i),
+              i % 2 ? "lost" : "still found after its delete");
+    }
+    for (i = 0; i < SUBS; i += 2) {
+        CHECK(Delete_Subscriber(sub_id(i)) == 1, "%d deleted twice\n", sub_id(i));
+    }
+
+    worst = 0;
+    t = now();
+    for (i = 0; i < SUBS; i += 2) {
+        CHECK(registration(i, &worst) == 0, "registration of %d again failed\n", sub_id(i));
+    }
+    printf("registered %d subs again in %.2fs, slowest %.1fus\n", SUBS / 2, now() - t,
+           worst * 1e6);
+    for (i = 0; i < SUBS; i++) {
+        CHECK(Consume_Pending(sub_id(i), -1) == 0, "%d not found\n", sub_id(i));
+    }
+
+    /* Subscribers with groups live in the same directory */
+    CHECK(Subscriber_Registration(0, -5, gids, 3) == 1, "negative sId registered\n");
+    CHECK(Delete_Subscriber(sub_id(1)) == 0, "delete of %d failed\n", sub_id(1));
+    CHECK(Subscriber_Registration(0, sub_id(1), gids, 3) == 0, "registration with groups failed\n");
+    CHECK(Insert_Info(1, 7, info, 2) == 0 && Prune(2) == 0, "insert to group 5 failed\n");
+    CHECK(Consume_Pending(sub_id(1), 5) == 1 && Consume_Pending(sub_id(1), -1) == 1,
+          "groups of %d lost\n", sub_id(1));
+
+    CHECK(free_all() == 0, "free_all failed\n");
+
+    /* p=1 hashes every sId to one chain until the table grows */
+    CHECK(initialize_config(11, 1, &cfg) == 0, "initialize_config with p=1 failed\n");
+    for (i = 0; i < 1000; i++) {
+        CHECK(registration(i, &worst) == 0, "registration of %d with p=1 failed\n", sub_id(i));
+    }
+    for (i = 0; i < 1000; i++) {
+        CHECK(Consume_Pending(sub_id(i), -1) == 0, "%d not found with p=1\n", sub_id(i));
+    }
+    CHECK(free_all() == 0, "free_all failed\n");
+    CHECK(initialize_config(11, 0, &cfg) == 1 && initialize_config(0, 101, &cfg) == 1,
+          "initialize_config accepted m or p of 0\n");
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+/***************************************************************
+ *
+ * file: test_reinsert.c
+ *
+ * @brief   Test of the ids held by a group's delivery log.
+ * A pruned info's id stays taken while a sub of its group may still
+ * consume it. Once the group's last sub is deleted, every id of the
+ * log (the entries of its tail segment included) is free to be
+ * inserted again.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pss.h"
+
+#define INFOS 200 // Spans a few log segments
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+static int insert(int tm, int id, int gId) {
+    int gids[2];
+    gids[0] = gId;
+    gids[1] = -1;
+    return Insert_Info(tm, id, gids, 2);
+}
+
+static int subscribe(int tm, int sId, int gId) {
+    int gids[2];
+    gids[0] = gId;
+    gids[1] = -1;
+    return Subscriber_Registration(tm, sId, gids, 2);
+}
+
+int main(void) {
+    Config cfg = { 0 };
+    int i;
+
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_NONE;
+    CHECK(initialize_config(11, 101, &cfg) == 0, "initialize_config failed\n");
+
+    /* One info, its only sub leaves */
+    CHECK(subscribe(1, 1, 5) == 0, "registration failed\n");
+    CHECK(insert(2, 10, 5) == 0, "insert failed\n");
+    CHECK(Prune(100) == 0 && Consume_Pending(1, -1) == 1, "10 not delivered\n");
+    CHECK(insert(3, 10, 6) == 1, "10 inserted while its sub may consume it\n");
+    CHECK(Delete_Subscriber(1) == 0, "delete failed\n");
+    CHECK(insert(101, 10, 5) == 0, "10 not inserted again after its sub left\n");
+    CHECK(Prune(200) == 0 && insert(201, 10, 5) == 0, "10 not inserted after a prune\n");
+
+    /* Several segments, held until the group's last sub leaves */
+    CHECK(subscribe(202, 2, 7) == 0 && subscribe(202, 3, 7) == 0, "registration failed\n");
+    for (i = 0; i < INFOS; i++) {
+        CHECK(insert(300 + i, 1000 + i, 7) == 0, "insert of %d failed\n", 1000 + i);
+    }
+    CHECK(Prune(300 + INFOS) == 0, "Prune failed\n");
+    CHECK(Consume(2) == 0 && Delete_Subscriber(2) == 0, "consume and delete of 2 failed\n");
+    for (i = 0; i < INFOS; i++) {
+        CHECK(insert(1000, 1000 + i, 8) == 1, "%d inserted while 3 may consume it\n", 1000 + i);
+    }
+    CHECK(Delete_Subscriber(3) == 0, "delete of 3 failed\n");
+    for (i = 0; i < INFOS; i++) {
+        CHECK(insert(1000, 1000 + i, 7) == 0, "%d not inserted again\n", 1000 + i);
+    }
+
+    /* The group's log goes on for a new sub */
+    CHECK(subscribe(1001, 4, 7) == 0, "registration failed\n");
+    CHECK(Prune(1000) == 0 && Consume_Pending(4, 7) == INFOS, "%ld infos delivered\n",
+          Consume_Pending(4, 7));
+    CHECK(Consume(4) == 0 && Consume_Pending(4, -1) == 0, "Consume failed\n");
+
+    CHECK(free_all() == 0, "free_all failed\n");
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
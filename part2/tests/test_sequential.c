@@ -0,0 +1,83 @@
+/***************************************************************
+ *
+ * file: test_sequential.c
+ *
+ * @brief   Stress test of the tree walks with 10M sequential iIds.
+ * They all go to one group and are pruned in two halves, so the prune
+ * walks see a tree of 10M infos (the recursive walks ran out of stack
+ * long before that). Then 10M more are inserted and freed node by node.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pss.h"
+
+#define INFOS 10000000
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    Config cfg = { 0 };
+    int gids[2] = { 0, -1 };
+    int n = (argc > 1) ? atoi(argv[1]) : INFOS;
+    double t;
+    int i;
+
+    cfg.groups = 1;
+    cfg.pools = 0; // free_all() walks the trees to free every info
+    cfg.output = OUTPUT_NONE;
+    CHECK(initialize_config(11, 101, &cfg) == 0, "initialize_config failed\n");
+    CHECK(Subscriber_Registration(0, 1, gids, 2) == 0, "registration failed\n");
+
+    t = now();
+    for (i = 0; i < n; i++) {
+        gids[0] = 0;
+        CHECK(Insert_Info(i, i, gids, 2) == 0, "insert of %d failed\n", i);
+    }
+    printf("inserted %d infos in %.2fs\n", n, now() - t);
+    for (i = 0; i < n; i += n / 100) {
+        gids[0] = 0;
+        CHECK(Insert_Info(n + i, i, gids, 2) == 1, "%d inserted twice\n", i);
+    }
+
+    t = now();
+    CHECK(Prune(n / 2 - 1) == 0, "Prune failed\n");
+    CHECK(Consume_Pending(1, 0) == n / 2, "%ld infos delivered\n", Consume_Pending(1, 0));
+    CHECK(Consume(1) == 0 && Consume_Pending(1, 0) == 0, "Consume failed\n");
+    CHECK(Prune(n - 1) == 0, "Prune failed\n");
+    printf("pruned them in %.2fs\n", now() - t);
+    CHECK(Consume_Pending(1, 0) == n - n / 2, "%ld infos delivered\n", Consume_Pending(1, 0));
+
+    /* The group's tree is empty, new infos start it over */
+    t = now();
+    for (i = 0; i < n; i++) {
+        gids[0] = 0;
+        CHECK(Insert_Info(n + i, n + i, gids, 2) == 0, "insert of %d failed\n", n + i);
+    }
+    printf("inserted %d more in %.2fs\n", n, now() - t);
+    CHECK(Prune(n) == 0 && Consume_Pending(1, 0) == n - n / 2 + 1,
+          "insert after the prune lost\n");
+
+    t = now();
+    CHECK(free_all() == 0, "free_all failed\n");
+    printf("freed in %.2fs\nok\n", now() - t);
+    return EXIT_SUCCESS;
+}
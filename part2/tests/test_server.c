@@ -0,0 +1,354 @@
+/***************************************************************
+ *
+ * file: test_server.c
+ *
+ * @brief   Test of the driver's server against file replay.
+ * The driver replays a trace from its file, then serves it on a Unix
+ * socket, with and without --publish, to a client that sends it all
+ * at once and to --load. The server must answer every command with the
+ * event's output and OK, or FAILED where the replay failed. The trace
+ * ends with an unterminated command, which both must run. Subs are
+ * listed in hash order, which differs between runs, so each event's
+ * lines are compared sorted and without the list of all subs.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#ifndef RUN
+#define RUN "build/run"
+#endif
+
+#define EVENTS 3000
+#define SUBS 200
+#define IDS 1500 // Some ids are inserted twice
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+static char dir[] = "/tmp/test_serverXXXXXX";
+
+static unsigned int next(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static void path(char *buf, const char *name) {
+    snprintf(buf, 108, "%s/%s", dir, name);
+}
+
+static void gids(FILE *f, unsigned int *seed) {
+    int i, n = 1 + next(seed) % 3;
+    for (i = 0; i < n; i++) {
+        fprintf(f, " %d", (int) (next(seed) % 70));
+    }
+    fprintf(f, " -1\n");
+}
+
+/* Writes the trace, and returns its number of commands */
+static int trace(const char *name) {
+    FILE *f = fopen(name, "w");
+    unsigned int seed = 11;
+    int i, tm = 0;
+
+    for (i = 0; i < EVENTS; i++) {
+        tm += 1 + next(&seed) % 3;
+        switch (next(&seed) % 10) {
+        case 0: case 1: case 2: case 3:
+            fprintf(f, "I %d %d", tm, (int) (next(&seed) % IDS));
+            gids(f, &seed);
+            break;
+        case 4: case 5:
+            fprintf(f, "S %d %d", tm, (int) (next(&seed) % SUBS));
+            gids(f, &seed);
+            break;
+        case 6:
+            fprintf(f, "R %d\n", tm - (int) (next(&seed) % 60));
+            break;
+        case 7:
+            fprintf(f, "C %d\n", (int) (next(&seed) % SUBS));
+            break;
+        case 8:
+            fprintf(f, "D %d\n", (int) (next(&seed) % SUBS));
+            break;
+        default:
+            fprintf(f, (next(&seed) % 10 == 0) ? "P\n" : "C %d\n", (int) (next(&seed) % SUBS));
+        }
+    }
+    // Without its newline
+    fprintf(f, "P");
+    fclose(f);
+    return EVENTS + 1;
+}
+
+/* Starts the driver with its output going to files (NULL: /dev/null) */
+static pid_t start(char *const argv[], const char *out, const char *err) {
+    pid_t pid;
+    fflush(stdout); // Else the child writes what is buffered again
+    pid = fork();
+    if (pid == 0) {
+        if (freopen(out != NULL ? out : "/dev/null", "w", stdout) == NULL ||
+            freopen(err != NULL ? err : "/dev/null", "w", stderr) == NULL) {
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int finish(pid_t pid) {
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+static char *slurp(const char *name, size_t *len) {
+    FILE *f = fopen(name, "r");
+    size_t cap = 1 << 16;
+    char *buf = (char *) malloc(cap);
+    *len = 0;
+    while (f != NULL && !feof(f)) {
+        if (*len + 1 == cap) {
+            cap *= 2;
+            buf = (char *) realloc(buf, cap);
+        }
+        *len += fread(buf + *len, 1, cap - *len - 1, f);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    buf[*len] = '\0';
+    return buf;
+}
+
+/* Connects to the server, once it listens */
+static int dial(const char *addr) {
+    struct sockaddr_un un;
+    struct timespec pause = { 0, 10000000 };
+    int fd, i;
+
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, addr);
+    for (i = 0; i < 500; i++) {
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *) &un, sizeof(un)) == 0) {
+            return fd;
+        }
+        close(fd);
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+/* Sends all the commands while taking the responses, until the server is done */
+static char *exchange(const char *addr, const char *req, size_t reqlen, size_t *len) {
+    struct pollfd p;
+    size_t sent = 0, cap = 1 << 16;
+    char *buf;
+    ssize_t k;
+    int fd = dial(addr);
+
+    if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        return NULL;
+    }
+    buf = (char *) malloc(cap);
+    *len = 0;
+    for (;;) {
+        p.fd = fd;
+        p.events = POLLIN | (sent < reqlen ? POLLOUT : 0);
+        if (poll(&p, 1, 10000) <= 0) {
+            break;
+        }
+        if ((p.revents & POLLOUT) && (k = write(fd, req + sent, reqlen - sent)) > 0) {
+            sent += (size_t) k;
+            if (sent == reqlen) {
+                shutdown(fd, SHUT_WR);
+            }
+        }
+        if (p.revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (*len + (1 << 15) > cap) {
+                cap *= 2;
+                buf = (char *) realloc(buf, cap);
+            }
+            k = read(fd, buf + *len, cap - *len - 1);
+            if (k == 0 || (k < 0 && errno != EAGAIN)) {
+                break;
+            }
+            if (k > 0) {
+                *len += (size_t) k;
+            }
+        }
+    }
+    close(fd);
+    buf[*len] = '\0';
+    return buf;
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Splits output into lines with each event's lines sorted, without the
+ * list of all subs. Status lines are counted instead */
+static char **lines(char *buf, int *n, int *ok, int *failed) {
+    char **out = NULL, *line, *nl;
+    int cap = 0, ev = 0;
+    *n = *ok = *failed = 0;
+    for (line = buf; *line != '\0'; line = nl + 1) {
+        if ((nl = strchr(line, '\n')) == NULL) {
+            nl = line + strlen(line) - 1; // The last line (kept whole)
+        } else {
+            *nl = '\0';
+        }
+        if (strcmp(line, "OK") == 0) {
+            (*ok)++;
+        } else if (strcmp(line, "FAILED") == 0) {
+            (*failed)++;
+        } else if (strncmp(line, "    SUBSCRIBERLIST", 18) != 0) {
+            if (line[0] != ' ') {
+                qsort(out + ev, *n - ev, sizeof(char *), compare_lines);
+                ev = *n;
+            }
+            if (*n == cap) {
+                cap = cap ? 2 * cap : 1024;
+                out = (char **) realloc(out, cap * sizeof(char *));
+            }
+            out[(*n)++] = line;
+        }
+    }
+    qsort(out + ev, *n - ev, sizeof(char *), compare_lines);
+    return out;
+}
+
+/* Failed lines the replay wrote (a failed line may span two) */
+static int failures(const char *err) {
+    int n = 0;
+    while ((err = strstr(err, "failed\n")) != NULL) {
+        n++;
+        err++;
+    }
+    return n;
+}
+
+/* Serves the trace to one client and to --load, compared with the replay */
+static int serve(const char *option, const char *tracefile, int commands, char **replay,
+                 int nreplay, int failed) {
+    char addr[108], loadout[108], serve_arg[128], load_arg[128], *req, *resp, **got, *out;
+    char *server[] = { RUN, serve_arg, "11", "101", NULL, NULL };
+    char *client[] = { RUN, load_arg, "1", "16", (char *) tracefile, NULL };
+    size_t reqlen, len;
+    unsigned long requests, loadfailed;
+    int i, n, ok, nfailed;
+    pid_t pid;
+
+    path(addr, "server.sock");
+    path(loadout, "load.out");
+    snprintf(serve_arg, sizeof(serve_arg), "--serve=%s", addr);
+    snprintf(load_arg, sizeof(load_arg), "--load=%s", addr);
+    if (option != NULL) {
+        // Options come after --serve
+        server[2] = (char *) option;
+        server[3] = "11";
+        server[4] = "101";
+    }
+
+    /* One client sends everything at once */
+    req = slurp(tracefile, &reqlen);
+    pid = start(server, NULL, NULL);
+    resp = exchange(addr, req, reqlen, &len);
+    kill(pid, SIGTERM);
+    CHECK(finish(pid) == 0, "server %s failed\n", option ? option : "");
+    CHECK(resp != NULL, "no responses from the server %s\n", option ? option : "");
+    got = lines(resp, &n, &ok, &nfailed);
+    printf("server %s: %d commands answered, %d failed\n", option ? option : "", ok + nfailed,
+           nfailed);
+    CHECK(ok + nfailed == commands, "%d of %d commands answered\n", ok + nfailed, commands);
+    CHECK(nfailed == failed, "%d commands failed, %d in the replay\n", nfailed, failed);
+    for (i = 0; i < n && i < nreplay && strcmp(got[i], replay[i]) == 0; i++);
+    CHECK(n == nreplay && i == n, "server and replay differ:\n%s\n%s\n",
+          i < n ? got[i] : "(end)", i < nreplay ? replay[i] : "(end)");
+    free(got);
+    free(resp);
+    free(req);
+
+    /* --load sends them with 16 in flight */
+    pid = start(server, NULL, NULL);
+    close(dial(addr));
+    CHECK(finish(start(client, loadout, NULL)) == 0, "--load failed\n");
+    kill(pid, SIGTERM);
+    CHECK(finish(pid) == 0, "server %s failed\n", option ? option : "");
+    out = slurp(loadout, &len);
+    CHECK(sscanf(out, "%lu requests", &requests) == 1 && (out = strchr(out, '\n')) != NULL &&
+          sscanf(out + 1, "latency p50 %*f us, p99 %*f us, max %*f us, %lu failed",
+                 &loadfailed) == 1, "--load output not understood\n");
+    printf("load %s: %lu requests, %lu failed\n", option ? option : "", requests, loadfailed);
+    CHECK(requests == (unsigned long) commands && loadfailed == (unsigned long) failed,
+          "--load got %lu requests and %lu failures\n", requests, loadfailed);
+    return EXIT_SUCCESS;
+}
+
+int main(void) {
+    char tracefile[108], out[108], err[108], *text, *errs, **replay;
+    char *run[] = { RUN, "11", "101", NULL, NULL };
+    size_t len;
+    int commands, n, ok, none, failed, ret;
+
+    signal(SIGPIPE, SIG_IGN);
+    CHECK(mkdtemp(dir) != NULL, "mkdtemp failed\n");
+    path(tracefile, "trace.txt");
+    path(out, "replay.out");
+    path(err, "replay.err");
+    commands = trace(tracefile);
+
+    /* The replay of the file */
+    run[3] = tracefile;
+    CHECK(finish(start(run, out, err)) == 0, "replay failed\n");
+    text = slurp(out, &len);
+    errs = slurp(err, &len);
+    failed = failures(errs);
+    replay = lines(text, &n, &ok, &none);
+    printf("replay: %d commands, %d failed, %d lines\n", commands, failed, n);
+
+    ret = serve(NULL, tracefile, commands, replay, n, failed);
+    if (ret == EXIT_SUCCESS) {
+        ret = serve("--publish=64", tracefile, commands, replay, n, failed);
+    }
+    free(replay);
+    free(text);
+    free(errs);
+    unlink(tracefile);
+    unlink(out);
+    unlink(err);
+    path(out, "load.out");
+    unlink(out);
+    rmdir(dir);
+    if (ret == EXIT_SUCCESS) {
+        printf("ok\n");
+    }
+    return ret;
+}
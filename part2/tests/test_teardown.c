@@ -0,0 +1,99 @@
+/***************************************************************
+ *
+ * file: test_teardown.c
+ *
+ * @brief   Teardown test of a multi-million-node state.
+ * Builds subscribers, info trees, delivery logs and consumed
+ * positions, then frees them with the slab pools released in bulk,
+ * with every node freed on its own, and with fast_exit. Run it with
+ * "make asan": AddressSanitizer and LeakSanitizer must stay quiet.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pss.h"
+
+#define SUBS 1000000
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned int next(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/* Builds the state of n subs and 2n infos, then frees it */
+static int run(int n, int pools, int fast_exit) {
+    Config cfg = { 0 };
+    Delivery out[64];
+    unsigned int seed = 1;
+    int gids[4];
+    double t;
+    int i;
+
+    cfg.groups = MG;
+    cfg.pools = pools;
+    cfg.output = OUTPUT_NONE;
+    cfg.fast_exit = fast_exit;
+    CHECK(initialize_config(1009, 1000003, &cfg) == 0, "initialize_config failed\n");
+    // Decreasing sIds go to the front of the groups' sorted sub lists
+    for (i = 0; i < n; i++) {
+        gids[0] = next(&seed) % MG;
+        gids[1] = next(&seed) % MG;
+        gids[2] = -1;
+        CHECK(Subscriber_Registration(i, n - 1 - i, gids, 3) == 0, "registration failed\n");
+    }
+    // Infos of groups registered upfront and on first use
+    for (i = 0; i < 2 * n; i++) {
+        gids[0] = next(&seed) % MG;
+        gids[1] = next(&seed) % (4 * MG);
+        gids[2] = next(&seed) % MG;
+        gids[3] = -1;
+        CHECK(Insert_Info(i, i, gids, 4) == 0, "insert failed\n");
+    }
+    CHECK(Prune(n) == 0, "Prune failed\n");
+    for (i = 0; i < n; i += 3) {
+        CHECK(Consume(i) == 0, "Consume failed\n");
+    }
+    for (i = 1; i < n; i += 5) {
+        CHECK(Consume_Batch(i, 64, out) >= 0, "Consume_Batch failed\n");
+    }
+    // The smallest sIds, near the front of the sorted sub lists
+    for (i = 0; i < n / 20; i += 5) {
+        CHECK(Delete_Subscriber(i) == 0, "Delete_Subscriber failed\n");
+    }
+    t = now();
+    CHECK(free_all() == 0, "free_all failed\n");
+    printf("pools=%d fast_exit=%d: free_all of %d subs and %d infos in %.3fs\n", pools,
+           fast_exit, n, 2 * n, now() - t);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int n = (argc > 1) ? atoi(argv[1]) : SUBS;
+
+    CHECK(run(n, 1, 0) == 0, "teardown with pools failed\n");
+    CHECK(run(n, 0, 0) == 0, "teardown without pools failed\n");
+    // Leaves everything reachable to the process' exit
+    CHECK(run(n, 1, 1) == 0, "fast teardown failed\n");
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+/***************************************************************
+ *
+ * file: test_threads.c
+ *
+ * @brief   Multi-threaded stress test of a thread safe engine.
+ * Threads insert, consume and race to insert the same ids on one
+ * engine, phase after phase, with a prune and deletes between phases.
+ * A second engine replays the same operations on one thread, and the
+ * final states of the two (every group, sub and pending info) must be
+ * the same. They are compared line by line in sorted order, without the
+ * list of all subs, since the engines' hash functions order the subs
+ * differently (each sub has lines of its own).
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pss.h"
+
+#define THREADS 8
+#define GROUPS 300  // Only 0..MG-1 are registered upfront
+#define SUBS 2000
+#define EVENTS 4000 // Per thread and phase
+#define PHASES 6
+#define BATCH 64
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+/* Output of an engine, kept once capturing is on */
+struct Capture {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int on;
+};
+typedef struct Capture Capture;
+
+struct Worker {
+    Engine *engine;
+    int phase;
+    int id;
+    int won; // Racing inserts it won
+};
+typedef struct Worker Worker;
+
+static unsigned int next(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static void capture_put(Capture *c, const char *buf, size_t len) {
+    if (c->len + len > c->cap) {
+        c->cap = 2 * (c->len + len);
+        c->buf = (char *) realloc(c->buf, c->cap);
+    }
+    memcpy(c->buf + c->len, buf, len);
+    c->len += len;
+}
+
+static void capture(const char *buf, size_t len, void *ctx) {
+    if (((Capture *) ctx)->on) {
+        capture_put((Capture *) ctx, buf, len);
+    }
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Splits captured output into its lines, sorted, without the list of subs */
+static char **sorted_lines(Capture *c, int *n) {
+    char **lines;
+    size_t i;
+    int k = 0;
+    capture_put(c, "", 1);
+    for (i = 0; i + 1 < c->len; i++) {
+        k += (c->buf[i] == '\n');
+    }
+    lines = (char **) malloc((k + 1) * sizeof(char *));
+    *n = 0;
+    lines[(*n)++] = c->buf;
+    for (i = 0; i + 1 < c->len; i++) {
+        if (c->buf[i] == '\n') {
+            c->buf[i] = '\0';
+            if (strncmp(lines[*n - 1], "    SUBSCRIBERLIST", 18) == 0) {
+                (*n)--;
+            }
+            lines[(*n)++] = c->buf + i + 1;
+        }
+    }
+    qsort(lines, *n, sizeof(char *), compare_lines);
+    return lines;
+}
+
+/* A thread's events of a phase (the same ones whichever engine runs them) */
+static void *work(void *arg) {
+    Worker *w = (Worker *) arg;
+    unsigned int seed = (unsigned int) (w->phase * 977 + w->id * 31 + 1);
+    Delivery out[BATCH];
+    int gids[6], i, j, n;
+
+    Engine_Use(w->engine);
+    for (i = 0; i < EVENTS; i++) {
+        switch (next(&seed) % 6) {
+        case 0:
+            Consume((int) (next(&seed) % SUBS));
+            break;
+        case 1:
+            Consume_Batch((int) (next(&seed) % SUBS), BATCH, out);
+            break;
+        case 2:
+            Consume_Pending((int) (next(&seed) % SUBS), -1);
+            break;
+        default:
+            // Some gids are given twice
+            n = 1 + next(&seed) % 4;
+            for (j = 0; j < n; j++) {
+                gids[j] = (int) (next(&seed) % GROUPS);
+            }
+            if (n > 1 && next(&seed) % 4 == 0) {
+                gids[n - 1] = gids[0];
+            }
+            gids[n] = -1;
+            Insert_Info(w->phase * 100000 + (int) (next(&seed) % 50000),
+                        w->phase * 10000000 + w->id * 100000 + i, gids, n + 1);
+        }
+        // Every thread inserts the same ids, only one insert of each may win
+        if (i % 100 == 0) {
+            gids[0] = 7;
+            gids[1] = -1;
+            if (Insert_Info(w->phase * 100000 + 5, 900000000 + w->phase * 1000 + i / 100, gids, 2) == 0) {
+                w->won++;
+            }
+        }
+    }
+    Engine_Use(NULL);
+    return NULL;
+}
+
+/* Runs every phase on an engine, with threads or one after another */
+static int run(Engine *e, int threaded, Capture *c) {
+    pthread_t threads[THREADS];
+    Worker w[THREADS];
+    Delivery *out;
+    unsigned int seed = 5;
+    char line[64];
+    int gids[4], phase, s, t, i, k, n, won = 0;
+
+    Engine_Use(e);
+    Output_Sink(capture, c);
+    for (s = 0; s < SUBS; s++) {
+        gids[0] = (int) (next(&seed) % GROUPS);
+        gids[1] = (int) (next(&seed) % GROUPS);
+        gids[2] = (int) (next(&seed) % MG);
+        gids[3] = -1;
+        CHECK(Subscriber_Registration(0, s, gids, 4) == 0, "registration of %d failed\n", s);
+    }
+    for (phase = 0; phase < PHASES; phase++) {
+        for (t = 0; t < THREADS; t++) {
+            w[t].engine = e;
+            w[t].phase = phase;
+            w[t].id = t;
+            w[t].won = 0;
+            if (threaded) {
+                CHECK(pthread_create(&threads[t], NULL, work, &w[t]) == 0, "pthread_create failed\n");
+            } else {
+                work(&w[t]);
+            }
+        }
+        for (t = 0; t < THREADS; t++) {
+            if (threaded) {
+                pthread_join(threads[t], NULL);
+            }
+            won += w[t].won;
+        }
+        Engine_Use(e);
+        CHECK(Prune(phase * 100000 + 40000) == 0, "Prune failed\n");
+        for (s = phase; s < SUBS; s += 37) {
+            Delete_Subscriber(s);
+        }
+    }
+    CHECK(won == PHASES * (EVENTS / 100), "%d racing inserts won\n", won);
+
+    // The final state: everything printed, pending and consumable
+    c->on = 1;
+    CHECK(Print_all() == 0, "Print_all failed\n");
+    out = (Delivery *) malloc(PHASES * THREADS * EVENTS * sizeof(Delivery));
+    for (s = 0; s < SUBS; s++) {
+        n = sprintf(line, "%d %ld\n", s, Consume_Pending(s, -1));
+        capture_put(c, line, (size_t) n);
+        n = Consume_Batch(s, PHASES * THREADS * EVENTS, out);
+        for (i = 0; i < n; i++) {
+            k = sprintf(line, "%d consumed %d/%d/%d\n", s, out[i].gId, out[i].iId, out[i].itm);
+            capture_put(c, line, (size_t) k);
+        }
+    }
+    free(out);
+    CHECK(Engine_Free(e) == 0, "Engine_Free failed\n");
+    return EXIT_SUCCESS;
+}
+
+int main(void) {
+    Capture threaded = { NULL, 0, 0, 0 }, sequential = { NULL, 0, 0, 0 };
+    Config cfg = { 0 };
+    Engine *e;
+    char **a, **b;
+    int i, na, nb;
+
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_TEXT;
+    cfg.threadsafe = 1;
+    cfg.prune_threads = 2;
+    CHECK((e = Engine_New(101, 1000003, &cfg)) != NULL, "Engine_New failed\n");
+    CHECK(run(e, 1, &threaded) == 0, "threaded run failed\n");
+
+    cfg.threadsafe = 0;
+    cfg.prune_threads = 0;
+    CHECK((e = Engine_New(101, 1000003, &cfg)) != NULL, "Engine_New failed\n");
+    CHECK(run(e, 0, &sequential) == 0, "sequential run failed\n");
+
+    a = sorted_lines(&threaded, &na);
+    b = sorted_lines(&sequential, &nb);
+    printf("final states of %d and %d lines\n", na, nb);
+    for (i = 0; i < na && i < nb && strcmp(a[i], b[i]) == 0; i++);
+    CHECK(na == nb && i == na, "threaded and sequential states differ:\n%s\n%s\n",
+          i < na ? a[i] : "(end)", i < nb ? b[i] : "(end)");
+    free(a);
+    free(b);
+    free(threaded.buf);
+    free(sequential.buf);
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/***************************************************************
+ *
+ * file: test_watch.c
+ *
+ * @brief   Test of the notifications of watched subscribers.
+ * Covers the callbacks, the ready list with Ready_Take and its
+ * eventfd, being told again only after consuming everything, and
+ * being taken off by Subscriber_Unwatch and Delete_Subscriber. One
+ * group has a few watchers among many subs that don't watch, some of
+ * them leaving from the middle of its watchers.
+ *
+ ***************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+#include "pss.h"
+
+#define IDLE 100000 // Subs of the crowded group that don't watch
+#define WATCHERS 8
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            return EXIT_FAILURE; \
+        } \
+    } while (0)
+
+/* Times each sub was told through its callback */
+static int told[WATCHERS + 2];
+
+static void notify(int sId, void *ctx) {
+    (void) ctx;
+    told[sId]++;
+}
+
+static int readable(int fd) {
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    return poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+/* Inserts an info to a group and prunes it at once */
+static int deliver(int id, int gId) {
+    int gids[2];
+    gids[0] = gId;
+    gids[1] = -1;
+    if (Insert_Info(id, id, gids, 2) != 0) {
+        return 1;
+    }
+    return Prune(id);
+}
+
+int main(void) {
+    Config cfg = { 0 };
+    Delivery out[4];
+    int gids[3], ready[16];
+    int fd, i, id = 1;
+
+    cfg.groups = MG;
+    cfg.pools = 1;
+    cfg.output = OUTPUT_NONE;
+    CHECK(initialize_config(11, 101, &cfg) == 0, "initialize_config failed\n");
+
+    /* Callbacks: told once until everything is consumed */
+    gids[0] = 1;
+    gids[1] = 2;
+    gids[2] = -1;
+    CHECK(Subscriber_Registration(0, 1, gids, 3) == 0, "registration failed\n");
+    CHECK(Subscriber_Watch(1, notify, NULL) == 0 && told[1] == 0, "watch failed\n");
+    CHECK(Subscriber_Watch(99, notify, NULL) == 1, "unknown sub watched\n");
+    CHECK(deliver(id++, 1) == 0 && told[1] == 1, "not told of the first info\n");
+    CHECK(deliver(id++, 2) == 0 && told[1] == 1, "told again before consuming\n");
+    CHECK(Consume(1) == 0 && deliver(id++, 2) == 0 && told[1] == 2,
+          "not told again after consuming\n");
+    CHECK(deliver(id++, 3) == 0 && told[1] == 2, "told of a group it isn't in\n");
+
+    /* The ready list and its eventfd */
+    gids[0] = 3;
+    gids[1] = -1;
+    CHECK(Subscriber_Registration(0, 2, gids, 2) == 0, "registration failed\n");
+    fd = Ready_Fd();
+    CHECK(fd >= 0 && Ready_Fd() == fd, "Ready_Fd failed\n");
+    CHECK(deliver(id++, 3) == 0 && !readable(fd), "unwatched sub told\n");
+    CHECK(Subscriber_Watch(2, NULL, NULL) == 0, "watch failed\n");
+    // It was delivered to before watching
+    CHECK(readable(fd), "eventfd not readable with infos pending\n");
+    CHECK(Ready_Take(16, ready) == 1 && ready[0] == 2, "2 not ready\n");
+    CHECK(!readable(fd) && Ready_Take(16, ready) == 0, "ready list not emptied\n");
+    CHECK(deliver(id++, 3) == 0 && !readable(fd), "told again before consuming\n");
+    // A batch that takes everything is a full consume
+    CHECK(Consume_Batch(2, 4, out) == 2, "Consume_Batch failed\n");
+    CHECK(deliver(id++, 3) == 0 && readable(fd), "not told again after consuming\n");
+    // Consumed again before it was taken: dropped from the list
+    CHECK(Consume(2) == 0 && Ready_Take(16, ready) == 0 && !readable(fd),
+          "consumed sub taken\n");
+
+    /* Unwatch and delete take subs off */
+    CHECK(deliver(id++, 3) == 0 && readable(fd), "not told\n");
+    CHECK(Subscriber_Unwatch(2) == 0 && !readable(fd), "unwatched sub still queued\n");
+    CHECK(Subscriber_Unwatch(2) == 1, "unwatched twice\n");
+    CHECK(Consume(2) == 0 && deliver(id++, 3) == 0 && !readable(fd), "unwatched sub told\n");
+    CHECK(Consume(2) == 0 && Subscriber_Watch(2, NULL, NULL) == 0, "watch failed\n");
+    CHECK(deliver(id++, 3) == 0 && readable(fd), "not told\n");
+    CHECK(Delete_Subscriber(2) == 0 && !readable(fd) && Ready_Take(16, ready) == 0,
+          "deleted sub still queued\n");
+    CHECK(Consume(1) == 0 && Delete_Subscriber(1) == 0, "delete failed\n");
+    CHECK(deliver(id++, 1) == 0 && told[1] == 2, "deleted sub told\n");
+
+    /* Watchers of crowded groups, some leaving from the middle */
+    gids[0] = 9;
+    gids[1] = 8;
+    gids[2] = -1;
+    // Decreasing sIds go to the front of the groups' sorted sub lists
+    for (i = IDLE - 1; i >= 0; i--) {
+        CHECK(Subscriber_Registration(0, 1000 + i, gids, 3) == 0, "registration failed\n");
+    }
+    for (i = 1; i <= WATCHERS; i++) {
+        CHECK(Subscriber_Registration(0, i, gids, 3) == 0, "registration failed\n");
+        CHECK(Subscriber_Watch(i, notify, NULL) == 0, "watch of %d failed\n", i);
+        told[i] = 0;
+    }
+    CHECK(Subscriber_Unwatch(3) == 0 && Delete_Subscriber(5) == 0, "unwatch failed\n");
+    CHECK(deliver(id++, 9) == 0, "delivery failed\n");
+    for (i = 1; i <= WATCHERS; i++) {
+        CHECK(told[i] == (i != 3 && i != 5), "%d told %d times\n", i, told[i]);
+        if (i != 5) {
+            CHECK(Consume(i) == 0, "Consume failed\n");
+        }
+    }
+    CHECK(Subscriber_Watch(3, notify, NULL) == 0 && Subscriber_Unwatch(1) == 0, "watch failed\n");
+    CHECK(deliver(id++, 8) == 0, "delivery failed\n");
+    for (i = 1; i <= WATCHERS; i++) {
+        CHECK(told[i] == (i != 3 && i != 5) + (i != 1 && i != 5), "%d told %d times\n", i,
+              told[i]);
+    }
+
+    CHECK(free_all() == 0, "free_all failed\n");
+    printf("ok\n");
+    return EXIT_SUCCESS;
+}